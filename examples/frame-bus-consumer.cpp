@@ -0,0 +1,69 @@
+// Minimal frame bus consumer: attaches to a running screenRecorder started with
+// --frame-bus SOCKET, follows the newest frames and prints how many it kept up with.
+
+#include <csignal>
+#include <cstdio>
+#include <ctime>
+#include <vector>
+
+#include "../src/frame-bus.h"
+
+static volatile sig_atomic_t running = 1;
+
+static void handle_stop(int) { running = 0; }
+
+static uint64_t now_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s SOCKET\n", argv[0]);
+        return 1;
+    }
+
+    frame_bus_view view;
+    if (!frame_bus_attach(&view, argv[1]))
+        return 1;
+
+    const frame_bus_header *h = view.header;
+    printf("[consumer] attached: %ux%u stride %u, %u slots\n", h->width, h->height, h->stride,
+           h->slot_count);
+
+    signal(SIGINT, handle_stop);
+    signal(SIGTERM, handle_stop);
+
+    std::vector<uint8_t> frame(h->slot_size);
+    uint64_t seen = h->published.load();
+    uint64_t received = 0, skipped = 0, torn = 0;
+    uint64_t report_ns = now_ns();
+
+    while (running) {
+        const uint64_t published = frame_bus_wait(&view, seen, 500);
+        if (published <= seen)
+            continue;
+
+        frame_bus_frame info{};
+        if (!frame_bus_read_latest(&view, frame.data(), frame.size(), &info)) {
+            torn++;
+            seen = published;
+            continue;
+        }
+        skipped += info.frame_index - seen;
+        seen = info.frame_index + 1;
+        received++;
+
+        const uint64_t t = now_ns();
+        if (t - report_ns >= 1000000000ull) {
+            printf("[consumer] received %lu, skipped %lu, torn %lu (latency %.2f ms)\n",
+                   (unsigned long) received, (unsigned long) skipped, (unsigned long) torn,
+                   (t - info.pts_ns) / 1e6);
+            report_ns = t;
+        }
+    }
+
+    frame_bus_detach(&view);
+    return 0;
+}
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <sched.h>
+#include <string>
+#include <vector>
+
+// Embeddable screen capture, the API of libscreenrecorder, and the only header it installs.
+// A Recorder owns one capture session (a ScreenCast portal session, or a direct connection
+// to a PipeWire node), its stream, its encode pipeline and its counters, so several
+// Recorders can run side by side. They only share the process's D-Bus connections, which
+// GIO hands out per bus, and the log handler.
+//
+// Diagnostics go to stderr, one line each, unless recorder_set_log_handler installs a
+// handler. Writes to an ffmpeg that exited fail instead of raising SIGPIPE, whatever the
+// application's SIGPIPE disposition.
+//
+// Captured BGRA frames reach the application without a copy, in two ways:
+//  - recorder_config::on_frame runs on the PipeWire thread for every frame. The frame data
+//    is only valid until the callback returns, and the callback must not block.
+//  - with recorder_config::pull_frames, acquire_frame() hands over the newest frame not
+//    taken yet. Its buffer stays out of PipeWire's rotation, and the data valid, until
+//    release_frame(). Every acquired frame must be released before stop(). Held frames
+//    leave the producer fewer buffers to cycle, so hold them briefly: while no buffer can
+//    be spared, newer frames are not offered. Should PipeWire take the buffers back, one
+//    still held a second later fails the capture, through on_error, as its data is gone.
+//
+// The portal handshake runs asynchronously on the thread-default GLib main context, which
+// the caller must iterate (e.g. run a GMainLoop) for frames to start arriving.
+
+// One output file, as screenRecorder's --add-output describes it.
+struct output_profile {
+    uint32_t width = 0; // 0 keeps the capture size
+    uint32_t height = 0;
+    uint32_t fps = 30;  // frame rate of the file; captured frames beyond it are dropped
+    uint32_t every = 0; // keep one of every N captured frames instead, whatever their rate
+    int crf = 30;
+    std::string preset = "ultrafast";
+    uint32_t workers = 1;
+    uint32_t segment_seconds = 2;
+    bool adaptive = false;
+    float cpu_budget = 0.0f; // cores an adaptive output's encoders may use, 0 for no limit
+    std::string file;
+};
+
+// Placement of each pipeline role: CPU affinity plus either SCHED_FIFO with a priority or
+// SCHED_OTHER with a nice value. When the process lacks the privilege for a setting and
+// use_rtkit is set, the request is forwarded to org.freedesktop.RealtimeKit1 instead.
+enum sr_thread_role {
+    SR_ROLE_CAPTURE, // PipeWire loop thread
+    SR_ROLE_PROCESS, // colour conversion and downscaling
+    SR_ROLE_WRITER,  // threads feeding the encoder pipes
+    SR_ROLE_ENCODER, // ffmpeg child process
+    SR_ROLE_COUNT,
+};
+
+struct thread_policy {
+    bool has_cpus = false;
+    cpu_set_t cpus;
+
+    bool has_sched = false;
+    int policy = SCHED_OTHER;
+    int priority = 0; // SCHED_FIFO priority
+    int nice = 0;     // SCHED_OTHER nice value
+
+    bool use_rtkit = false;
+};
+
+struct recorder_frame {
+    const uint8_t *data;
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;
+    uint64_t pts_ns;   // CLOCK_MONOTONIC
+    uint64_t sequence; // counts every frame received, so gaps show skipped frames
+    void *buffer;      // handle for release_frame
+};
+
+struct recorder_config {
+    uint32_t input_fps_num = 1;
+    uint32_t input_fps_den = 1;
+    bool cursor_visible = true;
+    // A node name or a node id (digits only), or a daemon socket. With either set the portal
+    // is skipped.
+    std::string pipewire_node;
+    std::string pipewire_remote;
+    uint32_t pw_buffers = 8;
+    uint32_t pool_frames = 4;
+    thread_policy thread_policies[SR_ROLE_COUNT];
+    std::string frame_bus_path;
+    // Files to encode; may be empty when frames are only consumed in-process.
+    std::vector<output_profile> outputs;
+    uint32_t stop_timeout_ms = 5000;
+    // Pick the first output's preset, workers and size by benchmarking once the capture
+    // geometry is known, or from the cached result of an earlier run.
+    bool calibrate = false;
+    bool recalibrate = false; // ignore the cache
+
+    std::function<void(const recorder_frame &frame)> on_frame;
+    bool pull_frames = false;
+
+    // Runs once when the capture fails after start() returned: the portal session was
+    // refused, the stream could not connect, errored or lost its source. Called from the
+    // GLib or PipeWire thread; it must not call stop(), only arrange for it (e.g. quit the
+    // main loop).
+    std::function<void(const char *reason)> on_error;
+};
+
+// Counters of a running Recorder. Outputs count the frames they drop on their own.
+struct recorder_stats {
+    uint64_t captured;
+    uint64_t dropped; // before reaching any output
+    uint64_t zero_copy;
+    uint64_t copied;
+    uint64_t encoded;        // by all outputs together
+    uint64_t output_dropped; // by outputs that fell behind
+};
+
+// Installs the handler every diagnostic line is passed to, without its newline, instead of
+// stderr; an empty function restores stderr. Process-wide, shared by all Recorders, and
+// called from their internal threads.
+void recorder_set_log_handler(std::function<void(const char *line)> handler);
+
+struct pw_capture;
+struct ScreencastPortalCapture;
+
+class Recorder {
+public:
+    explicit Recorder(const recorder_config &config);
+    ~Recorder();
+
+    Recorder(const Recorder &) = delete;
+    Recorder &operator=(const Recorder &) = delete;
+
+    // Opens the session and connects the stream; false when that fails right away.
+    // A Recorder runs once: it cannot be started again after stop().
+    bool start();
+    // Stops capturing, drains and finalises the outputs within stop_timeout_ms.
+    void stop();
+
+    // Waits up to timeout_ms (-1 for no limit) for a frame; false on timeout or once stopped.
+    bool acquire_frame(recorder_frame *frame, int timeout_ms);
+    void release_frame(const recorder_frame &frame);
+
+    const recorder_config &config() const { return config_; }
+    // Fills stats; false before start().
+    bool stats(recorder_stats *stats) const;
+
+private:
+    recorder_config config_;
+    pw_capture *capture_ = nullptr;
+    ScreencastPortalCapture *portal_ = nullptr;
+    bool stopped_ = false;
+};
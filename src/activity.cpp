@@ -0,0 +1,106 @@
+#include <algorithm>
+#include <cstdlib>
+
+#include "activity.h"
+
+static const char *content_names[CONTENT_CLASS_COUNT] = {"unknown", "static", "text-scroll",
+                                                         "full-motion"};
+
+const char *content_class_name(content_class content) { return content_names[content]; }
+
+// Mean absolute difference between a[y] and b[y + shift] over the rows both cover.
+static double profile_distance(const int32_t *a, const int32_t *b, uint32_t height, int shift) {
+    const uint32_t first = shift < 0 ? -shift : 0;
+    const uint32_t last = shift > 0 ? height - shift : height;
+    int64_t sum = 0;
+    for (uint32_t y = first; y < last; y++)
+        sum += std::abs(a[y] - b[y + shift]);
+    return static_cast<double>(sum) / (last - first);
+}
+
+activity_sample activity_measure(activity_meter *meter, const i420_planes *frame) {
+    const uint32_t width = frame->width / ACTIVITY_STEP;
+    const uint32_t height = frame->height / ACTIVITY_STEP;
+    const uint32_t cols = (width + ACTIVITY_CELL - 1) / ACTIVITY_CELL;
+    const uint32_t rows = (height + ACTIVITY_CELL - 1) / ACTIVITY_CELL;
+    if (width != meter->width || height != meter->height) {
+        meter->width = width;
+        meter->height = height;
+        for (int i = 0; i < 2; i++) {
+            meter->samples[i].assign(static_cast<size_t>(width) * height, 0);
+            meter->profiles[i].assign(height, 0);
+        }
+        meter->cells.assign(static_cast<size_t>(cols) * rows, 0);
+        meter->primed = false;
+    }
+
+    const int next = meter->current ^ 1;
+    uint8_t *cur = meter->samples[next].data();
+    int32_t *profile = meter->profiles[next].data();
+    for (uint32_t y = 0; y < height; y++) {
+        const uint8_t *src = frame->y + static_cast<size_t>(y) * ACTIVITY_STEP * frame->y_stride;
+        uint8_t *row = cur + static_cast<size_t>(y) * width;
+        int32_t sum = 0;
+        for (uint32_t x = 0; x < width; x++) {
+            row[x] = src[x * ACTIVITY_STEP];
+            sum += row[x];
+        }
+        profile[y] = sum;
+    }
+
+    activity_sample sample{0.0f, false};
+    if (meter->primed && width && height) {
+        const uint8_t *prev = meter->samples[meter->current].data();
+        const int32_t *prev_profile = meter->profiles[meter->current].data();
+
+        std::fill(meter->cells.begin(), meter->cells.end(), 0);
+        uint32_t changed = 0;
+        for (uint32_t y = 0; y < height; y++) {
+            const uint8_t *a = cur + static_cast<size_t>(y) * width;
+            const uint8_t *b = prev + static_cast<size_t>(y) * width;
+            uint8_t *cell_row = meter->cells.data() + (y / ACTIVITY_CELL) * cols;
+            for (uint32_t x = 0; x < width; x++) {
+                if (std::abs(a[x] - b[x]) > ACTIVITY_PIXEL_THRESHOLD &&
+                    !cell_row[x / ACTIVITY_CELL]) {
+                    cell_row[x / ACTIVITY_CELL] = 1;
+                    changed++;
+                }
+            }
+        }
+        sample.changed = static_cast<float>(changed) / (cols * rows);
+
+        // A scroll leaves the row profile intact but shifted, so some non-zero shift lines
+        // the two profiles up far better than none does.
+        const double still = profile_distance(profile, prev_profile, height, 0);
+        if (sample.changed >= 0.05f && still >= width) {
+            const int max_shift = static_cast<int>(height / 3);
+            double best = still;
+            for (int shift = -max_shift; shift <= max_shift; shift++) {
+                if (shift != 0)
+                    best = std::min(best, profile_distance(profile, prev_profile, height, shift));
+            }
+            sample.scrolled = best < still / 2;
+        }
+    }
+
+    meter->current = next;
+    meter->primed = true;
+    return sample;
+}
+
+void activity_add(activity_window *window, const activity_sample *sample) {
+    window->frames++;
+    window->changed += sample->changed;
+    if (sample->scrolled)
+        window->scrolled++;
+}
+
+content_class activity_classify(const activity_window *window) {
+    if (window->frames == 0)
+        return CONTENT_UNKNOWN;
+    if (window->scrolled * 4 >= window->frames)
+        return CONTENT_SCROLL;
+    if (window->changed / window->frames >= 0.15)
+        return CONTENT_MOTION;
+    return CONTENT_STATIC;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "convert.h"
+
+// Frame-difference statistics for content-adaptive encoding. Luma is sampled every
+// ACTIVITY_STEP pixels and compared with the previous frame cell by cell; a change that is
+// mostly a vertical shift of the previous frame's row profile counts as scrolling.
+
+#define ACTIVITY_STEP 4
+#define ACTIVITY_CELL 16 // cell edge, in samples
+#define ACTIVITY_PIXEL_THRESHOLD 12
+
+enum content_class {
+    CONTENT_UNKNOWN, // nothing measured yet
+    CONTENT_STATIC,
+    CONTENT_SCROLL,
+    CONTENT_MOTION,
+    CONTENT_CLASS_COUNT,
+};
+
+struct activity_sample {
+    float changed; // fraction of cells that differ from the previous frame
+    bool scrolled;
+};
+
+struct activity_meter {
+    uint32_t width = 0; // in samples
+    uint32_t height = 0;
+    std::vector<uint8_t> samples[2];
+    std::vector<int32_t> profiles[2]; // sum of each sampled row
+    std::vector<uint8_t> cells;
+    int current = 0;
+    bool primed = false;
+};
+
+// Activity accumulated over a window of frames, typically one segment.
+struct activity_window {
+    uint32_t frames = 0;
+    uint32_t scrolled = 0;
+    double changed = 0;
+};
+
+const char *content_class_name(content_class content);
+
+activity_sample activity_measure(activity_meter *meter, const i420_planes *frame);
+void activity_add(activity_window *window, const activity_sample *sample);
+content_class activity_classify(const activity_window *window);
@@ -0,0 +1,372 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "calibrate.h"
+#include "convert.h"
+#include "frame-pool.h"
+#include "log.h"
+#include "pipeline.h"
+
+// Fastest first; a preset that cannot keep up rules out every slower one.
+static const char *candidate_presets[] = {"ultrafast", "superfast", "veryfast", "medium"};
+static constexpr int candidate_count = sizeof(candidate_presets) / sizeof(candidate_presets[0]);
+
+// Required margin over the target rate, for the capture and everything else on the machine.
+#define CALIBRATION_HEADROOM 1.2
+#define CALIBRATION_SIZES 3
+// A candidate still measuring after this is far too slow to be picked.
+#define CALIBRATION_CANDIDATE_NS 20000000000ull
+
+/* ------------------------------------------------- */
+
+static std::string machine_key() {
+    char id[64] = "unknown";
+    if (FILE *f = fopen("/etc/machine-id", "r")) {
+        if (fscanf(f, "%63s", id) != 1)
+            strcpy(id, "unknown");
+        fclose(f);
+    }
+    return std::string(id) + "/" + std::to_string(std::thread::hardware_concurrency());
+}
+
+static std::string cache_dir() {
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    const std::string base = xdg && *xdg ? xdg : std::string(home ? home : "/tmp") + "/.cache";
+    return base + "/screen-recorder";
+}
+
+static std::string cache_key(uint32_t width, uint32_t height, const output_profile *profile) {
+    char key[256];
+    snprintf(key, sizeof(key), "%s %ux%u size=%ux%u fps=%u crf=%d ->", machine_key().c_str(),
+             width, height, profile->width, profile->height, profile->fps, profile->crf);
+    return key;
+}
+
+bool calibration_load(uint32_t width, uint32_t height, const output_profile *profile,
+                      calibration_result *result) {
+    FILE *f = fopen((cache_dir() + "/calibration").c_str(), "r");
+    if (!f)
+        return false;
+
+    const std::string key = cache_key(width, height, profile);
+    bool found = false;
+    char line[512];
+    while (fgets(line, sizeof(line), f)) {
+        if (strncmp(line, key.c_str(), key.size()) != 0)
+            continue;
+        char preset[32];
+        calibration_result entry;
+        if (sscanf(line + key.size(),
+                   " preset=%31s workers=%u out=%ux%u convert=%lf scale=%lf encode=%lf", preset,
+                   &entry.workers, &entry.width, &entry.height, &entry.convert_fps,
+                   &entry.scale_fps, &entry.encode_fps) == 7) {
+            entry.preset = preset;
+            *result = entry;
+            found = true;
+        }
+    }
+    fclose(f);
+    return found;
+}
+
+void calibration_save(uint32_t width, uint32_t height, const output_profile *profile,
+                      const calibration_result *result) {
+    const std::string dir = cache_dir();
+    const std::string path = dir + "/calibration";
+    mkdir(dir.substr(0, dir.find_last_of('/')).c_str(), 0700);
+    mkdir(dir.c_str(), 0700);
+
+    // Keep the entries of other machines and geometries, replace this one.
+    const std::string key = cache_key(width, height, profile);
+    std::vector<std::string> lines;
+    if (FILE *f = fopen(path.c_str(), "r")) {
+        char line[512];
+        while (fgets(line, sizeof(line), f)) {
+            if (strncmp(line, key.c_str(), key.size()) != 0)
+                lines.emplace_back(line);
+        }
+        fclose(f);
+    }
+
+    const std::string tmp = path + ".tmp";
+    FILE *f = fopen(tmp.c_str(), "w");
+    if (!f) {
+        sr_log("[calibrate] cannot write %s: %s\n", tmp.c_str(), strerror(errno));
+        return;
+    }
+    for (const std::string &line : lines)
+        fputs(line.c_str(), f);
+    fprintf(f, "%s preset=%s workers=%u out=%ux%u convert=%.1f scale=%.1f encode=%.1f\n",
+            key.c_str(), result->preset.c_str(), result->workers, result->width, result->height,
+            result->convert_fps, result->scale_fps, result->encode_fps);
+    fclose(f);
+    rename(tmp.c_str(), path.c_str());
+}
+
+void calibration_apply(const calibration_result *result, output_profile *profile) {
+    profile->preset = result->preset;
+    profile->workers = result->workers;
+    if (result->width && result->height) {
+        profile->width = result->width;
+        profile->height = result->height;
+    }
+}
+
+/* ------------------------------------------------- */
+
+// Screen-like test content: a page of text-like lines that scrolls, plus a moving patch of
+// noise standing in for video, so the encoder sees both kinds of motion.
+struct synthetic_source {
+    uint32_t width;
+    uint32_t height;
+    std::vector<uint8_t> page; // BGRA, twice the frame height
+    std::vector<uint8_t> noise;
+};
+
+static void synthetic_init(synthetic_source *src, uint32_t width, uint32_t height) {
+    src->width = width;
+    src->height = height;
+    src->page.resize(static_cast<size_t>(width) * 4 * height * 2);
+    for (uint32_t y = 0; y < height * 2; y++) {
+        uint8_t *row = src->page.data() + static_cast<size_t>(y) * width * 4;
+        const bool text_row = (y % 24) < 14 && (y / 24) % 7 != 0;
+        for (uint32_t x = 0; x < width; x++) {
+            const bool ink = text_row && ((x / 9 + y / 24) % 5) != 0 && ((x * 7 + y) % 11) < 6;
+            const uint8_t value = ink ? 40 : static_cast<uint8_t>(235 - (y % 64) / 8);
+            row[4 * x] = value;
+            row[4 * x + 1] = value;
+            row[4 * x + 2] = ink ? value : 245;
+            row[4 * x + 3] = 255;
+        }
+    }
+    src->noise.resize(static_cast<size_t>(width / 4) * 4 * (height / 4) * 2);
+    uint32_t state = 0x9e3779b9;
+    for (uint8_t &byte : src->noise) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        byte = static_cast<uint8_t>(state);
+    }
+}
+
+static void synthetic_fill(const synthetic_source *src, uint8_t *dst, uint32_t stride,
+                           uint32_t index) {
+    const uint32_t row_bytes = src->width * 4;
+    const uint32_t scroll = (index * 8) % src->height;
+    for (uint32_t y = 0; y < src->height; y++)
+        memcpy(dst + static_cast<size_t>(y) * stride,
+               src->page.data() + static_cast<size_t>(y + scroll) * row_bytes, row_bytes);
+
+    const uint32_t patch_w = src->width / 4;
+    const uint32_t patch_h = src->height / 4;
+    const uint32_t x0 = (index * 16) % std::max(1u, src->width - patch_w);
+    const size_t noise_size = src->noise.size() / 2;
+    const uint8_t *noise = src->noise.data() + (index * 4099u * 4) % noise_size;
+    for (uint32_t y = 0; y < patch_h; y++)
+        memcpy(dst + static_cast<size_t>(y + patch_h) * stride + x0 * 4,
+               noise + static_cast<size_t>(y) * patch_w * 4, patch_w * 4);
+}
+
+static double seconds_since(uint64_t start) { return (now_ns() - start) / 1e9; }
+
+// Colour conversion and one pyramid step, the fixed per-frame cost before any encoder.
+static void measure_conversion(const synthetic_source *src, calibration_result *result) {
+    constexpr uint32_t frames = 20;
+    frame_pool full, half;
+    if (!frame_pool_init(&full, FRAME_FORMAT_I420, src->width, src->height, 1) ||
+        !frame_pool_init(&half, FRAME_FORMAT_I420, (src->width / 2) & ~1u,
+                         (src->height / 2) & ~1u, 1))
+        return;
+
+    std::vector<uint8_t> bgra(static_cast<size_t>(src->width) * 4 * src->height);
+    synthetic_fill(src, bgra.data(), src->width * 4, 0);
+    uint8_t *full_frame = frame_pool_acquire(&full);
+    uint8_t *half_frame = frame_pool_acquire(&half);
+    const i420_planes full_planes = frame_pool_i420(&full, full_frame);
+    const i420_planes half_planes = frame_pool_i420(&half, half_frame);
+
+    uint64_t start = now_ns();
+    for (uint32_t i = 0; i < frames; i++)
+        bgra_to_i420(bgra.data(), src->width * 4, &full_planes);
+    result->convert_fps = frames / seconds_since(start);
+
+    start = now_ns();
+    for (uint32_t i = 0; i < frames; i++)
+        i420_downscale_2x(&full_planes, &half_planes);
+    result->scale_fps = frames / seconds_since(start);
+
+    frame_pool_destroy(&full);
+    frame_pool_destroy(&half);
+}
+
+static void remove_dir(const std::string &dir) {
+    if (DIR *d = opendir(dir.c_str())) {
+        while (const dirent *entry = readdir(d)) {
+            if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0)
+                unlink((dir + "/" + entry->d_name).c_str());
+        }
+        closedir(d);
+    }
+    rmdir(dir.c_str());
+}
+
+static bool cancelled(const std::atomic<bool> *cancel) { return cancel && *cancel; }
+
+// Frames per second the pipeline thread converts and scales down to a pyramid level, from the
+// measured conversion and first 2x step; every further step has a quarter of the pixels.
+static double process_fps(const calibration_result *result, uint32_t level) {
+    double seconds = 1 / result->convert_fps;
+    for (uint32_t step = 0; step < level; step++)
+        seconds += 1 / result->scale_fps / (1u << (2 * step));
+    return 1 / seconds;
+}
+
+// Feeds synthetic frames through a real pipeline whose output waits for room instead of
+// dropping, and returns the rate at which the encoder took them after a second of warm-up.
+// ffmpeg's startup, stopping the pipeline and joining segments are not timed.
+static double measure_encode(const synthetic_source *src, output_profile candidate,
+                             const thread_policy *policies, const std::string &dir,
+                             const std::atomic<bool> *cancel) {
+    candidate.every = 1;
+    candidate.adaptive = false;
+    candidate.segment_seconds = 1;
+    candidate.file = dir + "/calibration.mp4";
+    const uint64_t warmup = candidate.fps;
+    const uint64_t frames = warmup + (candidate.workers + 1) * candidate.fps;
+
+    sr_stats stats;
+    pipeline pipe;
+    const std::vector<output_profile> outputs{candidate};
+    if (!pipeline_init(&pipe, src->width, src->height, outputs, 4, policies, &stats))
+        return 0;
+    encoder *enc = pipe.outputs[0];
+    enc->discard = true;
+    encoder_block(enc, 0);
+
+    const uint64_t limit = now_ns() + CALIBRATION_CANDIDATE_NS;
+    uint64_t start = 0, now = 0, encoded = 0;
+    for (uint32_t index = 0;;) {
+        now = now_ns();
+        encoded = enc->encoded;
+        if (!start && encoded >= warmup)
+            start = now;
+        if (encoded >= frames || now > limit || cancelled(cancel))
+            break;
+
+        uint8_t *frame = pipeline_acquire(&pipe);
+        if (!frame) {
+            usleep(200);
+            continue;
+        }
+        synthetic_fill(src, frame, pipe.capture_pool.stride, index++);
+        pipeline_submit(&pipe, frame, pipe.capture_pool.stride, now, nullptr);
+    }
+
+    // Nothing left to measure, so the frames still queued are dropped and ffmpeg is
+    // interrupted; the discarded output makes no noise about either.
+    pipeline_stop(&pipe, now_ns());
+    pipeline_destroy(&pipe);
+    // A candidate cut short by the time limit is rated on what it managed.
+    return start && now > start ? (encoded - warmup) / ((now - start) / 1e9) : 0;
+}
+
+calibration_status calibrate(uint32_t width, uint32_t height, const output_profile *profile,
+                             const thread_policy *policies, const std::atomic<bool> *cancel,
+                             calibration_result *result) {
+    synthetic_source src;
+    synthetic_init(&src, width, height);
+
+    std::vector<uint32_t> worker_options{1};
+    const uint32_t cpus = std::thread::hardware_concurrency();
+    if (cpus >= 4)
+        worker_options.push_back(std::min(4u, cpus / 2));
+
+    const double needed = profile->fps * CALIBRATION_HEADROOM;
+    measure_conversion(&src, result);
+    if (result->convert_fps == 0 || result->scale_fps == 0)
+        return CALIBRATION_FAILED;
+    sr_log("[calibrate] %ux%u: conversion %.0f fps, 2x scaling %.0f fps\n", width, height,
+           result->convert_fps, result->scale_fps);
+    if (result->convert_fps < needed) {
+        // Every candidate would be bound by the conversion, so none is worth measuring.
+        sr_log("[calibrate] conversion alone cannot keep up with %u fps\n", profile->fps);
+        result->preset = candidate_presets[0];
+        result->workers = worker_options.back();
+        result->width = profile->width;
+        result->height = profile->height;
+        result->encode_fps = 0;
+        return CALIBRATION_FALLBACK;
+    }
+
+    char dir_template[] = "/tmp/sr-calibrate-XXXXXX";
+    if (!mkdtemp(dir_template)) {
+        sr_log("[calibrate] cannot create a scratch directory: %s\n", strerror(errno));
+        return CALIBRATION_FAILED;
+    }
+    const std::string dir = dir_template;
+
+    // The requested size first, then halvings of it until something keeps up.
+    uint32_t out_w = profile->width ? profile->width : width;
+    uint32_t out_h = profile->height ? profile->height : height;
+    bool found = false, measured = false;
+    for (int size = 0; size < CALIBRATION_SIZES && !found && !cancelled(cancel); size++) {
+        output_profile sized = *profile;
+        sized.width = size || profile->width ? out_w : 0;
+        sized.height = size || profile->height ? out_h : 0;
+        // Smaller outputs only add downscaling steps, so none of them would keep up either.
+        const double process = process_fps(result, pipeline_level(width, height, sized));
+        if (process < needed) {
+            sr_log("[calibrate] %ux%u: conversion and scaling cap it at %.0f fps\n", out_w,
+                   out_h, process);
+            break;
+        }
+
+        int best = -1;
+        for (const uint32_t workers : worker_options) {
+            // More workers only help if they allow a slower preset than fewer did.
+            for (int i = best + 1; i < candidate_count && !cancelled(cancel); i++) {
+                output_profile candidate = sized;
+                candidate.preset = candidate_presets[i];
+                candidate.workers = workers;
+                const double fps = measure_encode(&src, candidate, policies, dir, cancel);
+                if (cancelled(cancel))
+                    break;
+                sr_log("[calibrate] %ux%u, %s, %u workers: %.1f fps\n", out_w, out_h,
+                       candidate.preset.c_str(), workers, fps);
+
+                // Until something keeps up, the fastest setup tried is the fallback.
+                const bool keeps_up = fps >= needed;
+                if (keeps_up || (!found && i == 0)) {
+                    result->preset = candidate.preset;
+                    result->workers = workers;
+                    result->width = candidate.width;
+                    result->height = candidate.height;
+                    result->encode_fps = fps;
+                    measured = true;
+                }
+                if (!keeps_up)
+                    break;
+                found = true;
+                best = i;
+            }
+        }
+        out_w = (out_w / 2) & ~1u;
+        out_h = (out_h / 2) & ~1u;
+        if (out_w < 320)
+            break;
+    }
+
+    remove_dir(dir);
+    if (cancelled(cancel) || !measured)
+        return CALIBRATION_FAILED;
+    return found ? CALIBRATION_OK : CALIBRATION_FALLBACK;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include "encoder.h"
+#include "thread-policy.h"
+
+// Startup calibration. The real pipeline is run on synthetic frames at the capture geometry
+// for a range of presets, worker counts and output sizes, and the slowest preset (best
+// compression) that still keeps up with the output's frame rate wins. Sizes whose conversion
+// and downscaling alone cannot keep up are not tried. Results are cached
+// per machine, geometry and target in $XDG_CACHE_HOME/screen-recorder/calibration.
+
+struct calibration_result {
+    std::string preset;
+    uint32_t workers = 1;
+    uint32_t width = 0; // output size, 0 keeps the capture size
+    uint32_t height = 0;
+    // Measured throughput, in frames per second.
+    double convert_fps = 0;
+    double scale_fps = 0;
+    double encode_fps = 0;
+};
+
+bool calibration_load(uint32_t width, uint32_t height, const output_profile *profile,
+                      calibration_result *result);
+void calibration_save(uint32_t width, uint32_t height, const output_profile *profile,
+                      const calibration_result *result);
+
+enum calibration_status {
+    CALIBRATION_FAILED,   // cancelled or nothing measured; result must not be used
+    CALIBRATION_FALLBACK, // nothing keeps up; result holds the fastest configuration
+    CALIBRATION_OK,
+};
+
+// Measures the candidates for profile at width x height. Setting cancel, which may be
+// nullptr, ends the measurement early with CALIBRATION_FAILED.
+calibration_status calibrate(uint32_t width, uint32_t height, const output_profile *profile,
+                             const thread_policy *policies, const std::atomic<bool> *cancel,
+                             calibration_result *result);
+
+void calibration_apply(const calibration_result *result, output_profile *profile);
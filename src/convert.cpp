@@ -0,0 +1,74 @@
+#include <cstddef>
+
+#include "convert.h"
+
+static inline uint8_t luma(int b, int g, int r) {
+    return static_cast<uint8_t>(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+}
+
+static inline uint8_t chroma_u(int b, int g, int r) {
+    return static_cast<uint8_t>(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+}
+
+static inline uint8_t chroma_v(int b, int g, int r) {
+    return static_cast<uint8_t>(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+}
+
+void bgra_to_i420(const uint8_t *src, uint32_t src_stride, const i420_planes *dst) {
+    const uint32_t w = dst->width;
+    const uint32_t h = dst->height;
+
+    // Two source rows per iteration: both produce luma, their 2x2 average produces chroma.
+    for (uint32_t y = 0; y < h; y += 2) {
+        const uint8_t *row0 = src + static_cast<size_t>(y) * src_stride;
+        const uint8_t *row1 = y + 1 < h ? row0 + src_stride : row0;
+        uint8_t *y0 = dst->y + static_cast<size_t>(y) * dst->y_stride;
+        uint8_t *y1 = y + 1 < h ? y0 + dst->y_stride : y0;
+        uint8_t *u = dst->u + static_cast<size_t>(y / 2) * dst->uv_stride;
+        uint8_t *v = dst->v + static_cast<size_t>(y / 2) * dst->uv_stride;
+
+        for (uint32_t x = 0; x < w; x++) {
+            y0[x] = luma(row0[4 * x], row0[4 * x + 1], row0[4 * x + 2]);
+            y1[x] = luma(row1[4 * x], row1[4 * x + 1], row1[4 * x + 2]);
+        }
+
+        for (uint32_t x = 0; x < w / 2; x++) {
+            const uint8_t *a = row0 + 8 * x;
+            const uint8_t *b = row1 + 8 * x;
+            const int sb = (a[0] + a[4] + b[0] + b[4] + 2) >> 2;
+            const int sg = (a[1] + a[5] + b[1] + b[5] + 2) >> 2;
+            const int sr = (a[2] + a[6] + b[2] + b[6] + 2) >> 2;
+            u[x] = chroma_u(sb, sg, sr);
+            v[x] = chroma_v(sb, sg, sr);
+        }
+        if (w & 1) {
+            const uint8_t *a = row0 + 4 * (w - 1);
+            const uint8_t *b = row1 + 4 * (w - 1);
+            const int sb = (a[0] + b[0] + 1) >> 1;
+            const int sg = (a[1] + b[1] + 1) >> 1;
+            const int sr = (a[2] + b[2] + 1) >> 1;
+            u[w / 2] = chroma_u(sb, sg, sr);
+            v[w / 2] = chroma_v(sb, sg, sr);
+        }
+    }
+}
+
+static void downscale_plane(const uint8_t *src, uint32_t src_stride, uint8_t *dst,
+                            uint32_t dst_stride, uint32_t dst_width, uint32_t dst_height) {
+    for (uint32_t y = 0; y < dst_height; y++) {
+        const uint8_t *row0 = src + static_cast<size_t>(2 * y) * src_stride;
+        const uint8_t *row1 = row0 + src_stride;
+        uint8_t *out = dst + static_cast<size_t>(y) * dst_stride;
+        for (uint32_t x = 0; x < dst_width; x++)
+            out[x] = static_cast<uint8_t>(
+                    (row0[2 * x] + row0[2 * x + 1] + row1[2 * x] + row1[2 * x + 1] + 2) >> 2);
+    }
+}
+
+void i420_downscale_2x(const i420_planes *src, const i420_planes *dst) {
+    downscale_plane(src->y, src->y_stride, dst->y, dst->y_stride, dst->width, dst->height);
+    downscale_plane(src->u, src->uv_stride, dst->u, dst->uv_stride, (dst->width + 1) / 2,
+                    (dst->height + 1) / 2);
+    downscale_plane(src->v, src->uv_stride, dst->v, dst->uv_stride, (dst->width + 1) / 2,
+                    (dst->height + 1) / 2);
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstdint>
+
+// Plain C++ pixel kernels shared by every output, written so the compiler can vectorise the
+// inner loops. I420 here is BT.601 limited range, matching what ffmpeg's yuv420p output
+// produced when it did the conversion itself.
+
+struct i420_planes {
+    uint8_t *y;
+    uint8_t *u;
+    uint8_t *v;
+    uint32_t y_stride;
+    uint32_t uv_stride;
+    uint32_t width;
+    uint32_t height;
+};
+
+void bgra_to_i420(const uint8_t *src, uint32_t src_stride, const i420_planes *dst);
+
+// Halves dst from src with a 2x2 box filter. dst must be src->width / 2 by src->height / 2.
+void i420_downscale_2x(const i420_planes *src, const i420_planes *dst);
@@ -0,0 +1,727 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#include "encoder.h"
+#include "log.h"
+
+bool output_profile_parse(const char *arg, output_profile *profile) {
+    const std::string spec = arg;
+    size_t start = 0;
+    while (start < spec.size()) {
+        size_t end = spec.find(',', start);
+        if (end == std::string::npos)
+            end = spec.size();
+
+        const size_t eq = spec.find('=', start);
+        if (eq == std::string::npos || eq > end)
+            return false;
+        const std::string key = spec.substr(start, eq - start);
+        const std::string value = spec.substr(eq + 1, end - eq - 1);
+
+        if (key == "file") {
+            // Everything after file= is the path, so it may itself contain commas.
+            profile->file = spec.substr(eq + 1);
+            break;
+        }
+        if (key == "size") {
+            if (sscanf(value.c_str(), "%ux%u", &profile->width, &profile->height) != 2)
+                return false;
+        } else if (key == "fps") {
+            profile->fps = std::max(1, atoi(value.c_str()));
+        } else if (key == "every") {
+            profile->every = std::max(1, atoi(value.c_str()));
+        } else if (key == "crf") {
+            profile->crf = atoi(value.c_str());
+        } else if (key == "preset") {
+            profile->preset = value;
+        } else if (key == "workers") {
+            profile->workers = std::max(1, atoi(value.c_str()));
+        } else if (key == "segment") {
+            profile->segment_seconds = std::max(1, atoi(value.c_str()));
+        } else if (key == "adaptive") {
+            profile->adaptive = atoi(value.c_str()) != 0;
+        } else if (key == "budget") {
+            profile->cpu_budget = std::max(0.0f, strtof(value.c_str(), nullptr));
+        } else {
+            return false;
+        }
+        start = end + 1;
+    }
+    return !profile->file.empty();
+}
+
+uint32_t output_profile_backlog(const output_profile *profile, uint32_t pool_frames) {
+    // Segments go round-robin over workers that each take up to workers segment times per
+    // segment, so a segment waits for its worker about half of the others' segments on
+    // average. A single adaptive worker only has to ride out starting the next segment's
+    // ffmpeg; the previous one finishes in the background.
+    const uint32_t segment_frames = profile->segment_seconds * profile->fps;
+    if (profile->workers > 1)
+        return pool_frames + ((profile->workers - 1) * segment_frames + 1) / 2;
+    return pool_frames + (profile->adaptive ? profile->fps : 0);
+}
+
+/* ------------------------------------------------- */
+
+static void add_plane(std::vector<iovec> &rows, const uint8_t *plane, uint32_t stride,
+                      uint32_t row_bytes, uint32_t height) {
+    if (stride == row_bytes) {
+        rows.push_back({const_cast<uint8_t *>(plane), static_cast<size_t>(stride) * height});
+        return;
+    }
+    for (uint32_t y = 0; y < height; y++)
+        rows.push_back({const_cast<uint8_t *>(plane) + static_cast<size_t>(y) * stride, row_bytes});
+}
+
+// Writes one frame without its stride padding. Rows are gathered with writev so a padded
+// frame costs no more syscalls than a tightly packed one.
+static bool write_frame(int fd, const frame_pool *pool, uint8_t *data, std::vector<iovec> &rows) {
+    rows.clear();
+    if (pool->format == FRAME_FORMAT_I420) {
+        const i420_planes planes = frame_pool_i420(pool, data);
+        const uint32_t uv_width = (pool->width + 1) / 2;
+        const uint32_t uv_height = (pool->height + 1) / 2;
+        add_plane(rows, planes.y, planes.y_stride, pool->width, pool->height);
+        add_plane(rows, planes.u, planes.uv_stride, uv_width, uv_height);
+        add_plane(rows, planes.v, planes.uv_stride, uv_width, uv_height);
+    } else {
+        add_plane(rows, data, pool->stride, pool->width * 4, pool->height);
+    }
+
+    size_t first = 0;
+    while (first < rows.size()) {
+        const int n = static_cast<int>(std::min<size_t>(rows.size() - first, IOV_MAX));
+        ssize_t written = writev(fd, rows.data() + first, n);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        // Skip fully written rows and advance into a partially written one.
+        while (first < rows.size() && static_cast<size_t>(written) >= rows[first].iov_len) {
+            written -= static_cast<ssize_t>(rows[first].iov_len);
+            first++;
+        }
+        if (written > 0) {
+            rows[first].iov_base = static_cast<uint8_t *>(rows[first].iov_base) + written;
+            rows[first].iov_len -= written;
+        }
+    }
+    return true;
+}
+
+// fork/exec replacement for popen() that keeps the child pid, so the encoder process can be
+// placed. Arguments go to ffmpeg without a shell, so file names are taken literally. The policy
+// is applied in the child before exec, which makes every ffmpeg thread inherit it. With
+// write_fd set the child's stdin is a pipe whose write end is returned there.
+static pid_t spawn_ffmpeg(const std::vector<std::string> &args, const thread_policy *policy,
+                          int *write_fd) {
+    // Built before fork: the child may only make async-signal-safe calls.
+    std::vector<char *> argv;
+    for (const std::string &arg : args)
+        argv.push_back(const_cast<char *>(arg.c_str()));
+    argv.push_back(nullptr);
+
+    int fds[2] = {-1, -1};
+    if (write_fd && pipe2(fds, O_CLOEXEC) < 0)
+        return -1;
+
+    const pid_t pid = fork();
+    if (pid < 0) {
+        if (write_fd) {
+            close(fds[0]);
+            close(fds[1]);
+        }
+        return -1;
+    }
+    if (pid == 0) {
+        // Writer threads block SIGPIPE; ffmpeg gets the default behaviour back.
+        sigset_t pipe_signal;
+        sigemptyset(&pipe_signal);
+        sigaddset(&pipe_signal, SIGPIPE);
+        sigprocmask(SIG_UNBLOCK, &pipe_signal, nullptr);
+        if (write_fd)
+            dup2(fds[0], STDIN_FILENO);
+        if (policy)
+            sched_apply_child(policy);
+        execvp(argv[0], argv.data());
+        _exit(127);
+    }
+    if (write_fd) {
+        close(fds[0]);
+        *write_fd = fds[1];
+    }
+    return pid;
+}
+
+bool encoder_available() {
+    const char *path = getenv("PATH");
+    const std::string dirs = path ? path : "/usr/bin:/bin";
+    for (size_t start = 0; start <= dirs.size();) {
+        size_t end = dirs.find(':', start);
+        if (end == std::string::npos)
+            end = dirs.size();
+        // An empty entry is the current directory, as for execvp.
+        const std::string dir = end > start ? dirs.substr(start, end - start) : ".";
+        if (access((dir + "/ffmpeg").c_str(), X_OK) == 0)
+            return true;
+        start = end + 1;
+    }
+    return false;
+}
+
+// A relative path as ffmpeg should see it: "./" keeps a leading '-' from reading as an option
+// and a ':' from reading as a protocol prefix.
+static std::string ffmpeg_path(const std::string &path) {
+    return !path.empty() && path[0] == '/' ? path : "./" + path;
+}
+
+static std::string segment_path(const encoder *enc, uint64_t segment) {
+    return enc->profile.file + ".part" + std::to_string(segment) + ".mp4";
+}
+
+static std::vector<std::string> build_args(const encoder *enc, const std::string &file,
+                                           const encoder_settings *settings) {
+    const output_profile *profile = &enc->profile;
+    const frame_pool *pool = enc->pool;
+    const uint32_t width = profile->width ? profile->width : pool->width;
+    const uint32_t height = profile->height ? profile->height : pool->height;
+
+    // Segments are finished files that get concatenated later, so they can use lookahead
+    // and B-frames; only the continuous encode needs zerolatency and a fragmented MP4.
+    const bool segmented = enc->segment_frames != 0;
+
+    std::vector<std::string> args{"ffmpeg", "-nostdin", "-y", "-loglevel", "error"};
+    if (!segmented)
+        args.emplace_back("-stats");
+    args.insert(args.end(),
+                {"-f", "rawvideo", "-pix_fmt",
+                 pool->format == FRAME_FORMAT_I420 ? "yuv420p" : "bgra", "-s",
+                 std::to_string(pool->width) + "x" + std::to_string(pool->height), "-r",
+                 std::to_string(profile->fps), "-i", "-", "-c:v", "libx264", "-preset",
+                 settings ? settings->preset : profile->preset});
+    if (!segmented)
+        args.insert(args.end(), {"-tune", "zerolatency"});
+    args.insert(args.end(), {"-crf", std::to_string(settings ? settings->crf : profile->crf)});
+
+    // Adaptive segments differ in preset, so they pin the profile and repeat SPS/PPS at each
+    // keyframe; -c copy concatenation then stays decodable across the switches.
+    if (settings && settings->keyint)
+        args.insert(args.end(), {"-g", std::to_string(settings->keyint)});
+    if (settings)
+        args.insert(args.end(), {"-profile:v", "high", "-x264-params", "repeat-headers=1"});
+
+    args.insert(args.end(), {"-pix_fmt", "yuv420p"});
+    // The pipeline hands over the pyramid level closest to the target, so whatever scaling
+    // is left for ffmpeg is less than a factor of two.
+    if (width != pool->width || height != pool->height)
+        args.insert(args.end(), {"-vf", "scale=" + std::to_string(width) + ":" +
+                                                std::to_string(height) + ":flags=fast_bilinear"});
+    if (!segmented)
+        args.insert(args.end(), {"-movflags", "+faststart+frag_keyframe+empty_moov"});
+    args.push_back(ffmpeg_path(file));
+    return args;
+}
+
+static bool start_process(encoder_worker *w, const std::string &file) {
+    encoder *enc = w->enc;
+    const std::vector<std::string> args =
+            build_args(enc, file, enc->profile.adaptive ? &w->settings : nullptr);
+    w->pid = spawn_ffmpeg(args, enc->process_policy, &w->fd);
+    if (w->pid < 0) {
+        sr_log("[encoder] cannot start ffmpeg: %s\n", strerror(errno));
+        return false;
+    }
+    if (enc->process_policy)
+        sched_apply(SR_ROLE_ENCODER, enc->process_policy, w->pid, w->pid, enc->placements);
+    return true;
+}
+
+/* ------------------------------------------------- */
+
+static const char *preset_ladder[] = {"ultrafast", "superfast", "veryfast", "faster", "fast",
+                                      "medium",    "slow",      "slower",   "veryslow"};
+static constexpr int preset_count = sizeof(preset_ladder) / sizeof(preset_ladder[0]);
+
+static int preset_index(const std::string &preset) {
+    for (int i = 0; i < preset_count; i++) {
+        if (preset == preset_ladder[i])
+            return i;
+    }
+    return preset == "placebo" ? preset_count - 1 : 0;
+}
+
+// Static screens are cheap to encode even with slow presets and want sharp text and few
+// keyframes; motion hides artefacts, so it trades CRF for speed and keeps keyframes frequent.
+// The profile's preset and CRF are the motion baseline and also used before anything is
+// measured. Each class is then nudged faster by its CPU budget feedback.
+static encoder_settings choose_settings(encoder *enc, const segment_activity &activity) {
+    const output_profile &profile = enc->profile;
+    int slower = 0;
+    encoder_settings settings{activity, nullptr, profile.crf, 0};
+    switch (activity.content) {
+        case CONTENT_STATIC:
+            slower = 3;
+            settings.crf = profile.crf - 2;
+            settings.keyint = enc->segment_frames;
+            break;
+        case CONTENT_SCROLL:
+            slower = 1;
+            settings.keyint = 2 * profile.fps;
+            break;
+        case CONTENT_MOTION:
+            settings.crf = profile.crf + 2;
+            settings.keyint = profile.fps;
+            break;
+        default:
+            break;
+    }
+    settings.keyint = std::min(settings.keyint, enc->segment_frames);
+
+    std::lock_guard guard(enc->adaptive_lock);
+    const int index = preset_index(profile.preset) + slower + enc->preset_step[activity.content];
+    settings.preset = preset_ladder[std::clamp(index, 0, preset_count - 1)];
+    return settings;
+}
+
+// Logs what a finished segment cost and steps its class's preset against the CPU budget.
+static void record_segment(encoder *enc, const retired_segment &done, double cpu_seconds) {
+    const encoder_settings &settings = done.settings;
+    const double video_seconds = static_cast<double>(done.written) / enc->profile.fps;
+    struct stat st{};
+    const uint64_t bytes =
+            stat(segment_path(enc, done.segment).c_str(), &st) == 0 ? st.st_size : 0;
+    const double cores = video_seconds > 0 ? cpu_seconds / video_seconds : 0;
+    const double kbits = video_seconds > 0 ? bytes * 8 / video_seconds / 1000 : 0;
+
+    const content_class content = settings.activity.content;
+    const float budget = enc->profile.cpu_budget;
+    std::lock_guard guard(enc->adaptive_lock);
+    int &step = enc->preset_step[content];
+    if (budget > 0 && cores > budget && strcmp(settings.preset, preset_ladder[0]) != 0)
+        step--;
+    else if (step < 0 && (budget == 0 || cores < budget * 0.6))
+        step++;
+
+    adaptive_totals &totals = enc->totals[content];
+    totals.segments++;
+    totals.cpu_seconds += cpu_seconds;
+    totals.video_seconds += video_seconds;
+    totals.bytes += bytes;
+
+    sr_log("[adaptive] %s segment %ld: %s (%.0f%% changed, %.0f%% scrolling), preset %s, "
+           "crf %d, keyint %u -> %.2f cores, %.0f kbit/s\n",
+           enc->profile.file.c_str(), (long) done.segment, content_class_name(content),
+           settings.activity.changed * 100, settings.activity.scrolled * 100, settings.preset,
+           settings.crf, settings.keyint, cores, kbits);
+}
+
+static void report_adaptive(encoder *enc) {
+    for (int content = 0; content < CONTENT_CLASS_COUNT; content++) {
+        const adaptive_totals &totals = enc->totals[content];
+        if (!totals.segments || totals.video_seconds <= 0)
+            continue;
+        sr_log("[adaptive] %s %s: %u segments, %.1f s, %.2f cores, %.0f kbit/s\n",
+               enc->profile.file.c_str(), content_class_name(static_cast<content_class>(content)),
+               totals.segments, totals.video_seconds, totals.cpu_seconds / totals.video_seconds,
+               totals.bytes * 8 / totals.video_seconds / 1000);
+    }
+}
+
+/* ------------------------------------------------- */
+
+// Closes the current ffmpeg's input. It finishes its file in the background while the next
+// segment's ffmpeg already takes frames, so a segment boundary costs a fork, not a flush.
+static void retire_process(encoder_worker *w) {
+    if (w->fd >= 0) {
+        close(w->fd);
+        w->fd = -1;
+    }
+    if (w->pid > 0) {
+        std::lock_guard guard(w->lock);
+        w->retired.push_back({w->pid, w->segment, w->written, w->settings});
+        w->pid = -1;
+    }
+}
+
+// Collects the retired ffmpegs that have exited, or with block all of them. Reaping under
+// the lock keeps encoder_stop from signalling a pid that was already reused.
+static void reap_retired(encoder_worker *w, bool block) {
+    encoder *enc = w->enc;
+    for (;;) {
+        {
+            std::lock_guard guard(w->lock);
+            for (auto it = w->retired.begin(); it != w->retired.end();) {
+                int status;
+                rusage usage{};
+                const pid_t pid = wait4(it->pid, &status, WNOHANG, &usage);
+                if (pid == 0) {
+                    ++it;
+                    continue;
+                }
+                if (pid > 0 && enc->profile.adaptive && it->segment >= 0)
+                    record_segment(enc, *it,
+                                   usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+                                           usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6);
+                sched_forget(enc->placements, it->pid);
+                it = w->retired.erase(it);
+            }
+            if (!block || w->retired.empty())
+                return;
+        }
+        usleep(10000);
+    }
+}
+
+static void finish_process(encoder_worker *w) {
+    retire_process(w);
+    reap_retired(w, true);
+}
+
+// Signals the worker's ffmpeg and those of its segments still finishing.
+static bool signal_processes(encoder_worker *w, int sig) {
+    std::lock_guard guard(w->lock);
+    bool any = false;
+    if (const pid_t pid = w->pid; pid > 0)
+        any = kill(pid, sig) == 0;
+    for (const retired_segment &done : w->retired)
+        any |= kill(done.pid, sig) == 0;
+    return any;
+}
+
+static bool past_deadline(const encoder *enc) {
+    const uint64_t deadline = enc->stop_deadline_ns.load();
+    return deadline && now_ns() > deadline;
+}
+
+// Hands a frame's place in the queue back once the writer is done with it.
+static void unqueue(encoder *enc) {
+    {
+        std::lock_guard guard(enc->space_lock);
+        enc->queued--;
+    }
+    enc->space.notify_one();
+}
+
+static void writer_loop(encoder_worker *w) {
+    encoder *enc = w->enc;
+    // An ffmpeg that exited makes writes fail with EPIPE rather than kill the process, without
+    // touching the application's SIGPIPE disposition.
+    sigset_t pipe_signal;
+    sigemptyset(&pipe_signal);
+    sigaddset(&pipe_signal, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipe_signal, nullptr);
+    if (enc->writer_policy)
+        sched_apply(SR_ROLE_WRITER, enc->writer_policy, 0, 0, enc->placements);
+
+    std::vector<iovec> rows;
+    for (;;) {
+        encoder_frame frame;
+        {
+            std::unique_lock guard(w->lock);
+            w->cv.wait(guard, [w] { return w->stopping || !w->queue.empty(); });
+            if (w->queue.empty())
+                break;
+            frame = w->queue.front();
+            w->queue.pop_front();
+        }
+
+        if (past_deadline(enc)) {
+            enc->dropped++;
+            frame_pool_release(enc->pool, frame.data);
+            unqueue(enc);
+            continue;
+        }
+
+        if (enc->segment_frames && static_cast<int64_t>(frame.segment) != w->segment) {
+            retire_process(w);
+            w->segment = static_cast<int64_t>(frame.segment);
+            w->written = 0;
+            if (enc->profile.adaptive)
+                w->settings = choose_settings(enc, frame.activity);
+            start_process(w, segment_path(enc, frame.segment));
+        }
+
+        if (w->fd >= 0 && write_frame(w->fd, enc->pool, frame.data, rows)) {
+            enc->encoded++;
+            w->written++;
+        }
+        else
+            enc->dropped++;
+        frame_pool_release(enc->pool, frame.data);
+        unqueue(enc);
+        if (enc->segment_frames)
+            reap_retired(w, false);
+    }
+    finish_process(w);
+    sched_forget(enc->placements, 0);
+
+    {
+        std::lock_guard guard(w->lock);
+        w->done = true;
+    }
+    w->cv.notify_all();
+}
+
+static bool wait_done(encoder_worker *w, uint64_t deadline_ns) {
+    std::unique_lock guard(w->lock);
+    if (!deadline_ns) {
+        w->cv.wait(guard, [w] { return w->done; });
+        return true;
+    }
+    const auto until =
+            std::chrono::steady_clock::time_point(std::chrono::nanoseconds(deadline_ns));
+    return w->cv.wait_until(guard, until, [w] { return w->done; });
+}
+
+// Quotes a concat list entry: inside single quotes only ' itself needs escaping.
+static std::string concat_quote(const std::string &path) {
+    std::string quoted = "'";
+    for (const char c : path) {
+        if (c == '\'')
+            quoted += "'\\''";
+        else
+            quoted += c;
+    }
+    return quoted + "'";
+}
+
+// Reaps the concat ffmpeg, killing it if it is still running at deadline_ns.
+static int wait_concat(pid_t pid, uint64_t deadline_ns) {
+    int status = -1;
+    if (!deadline_ns)
+        return waitpid(pid, &status, 0) == pid ? status : -1;
+    for (;;) {
+        const pid_t done = waitpid(pid, &status, WNOHANG);
+        if (done == pid)
+            return status;
+        if (done < 0)
+            return -1;
+        if (now_ns() >= deadline_ns) {
+            kill(pid, SIGKILL);
+            waitpid(pid, &status, 0);
+            return -1;
+        }
+        usleep(10000);
+    }
+}
+
+// Joins the finished segments, in order, into the output file without re-encoding.
+static void concat_segments(encoder *enc, uint64_t segments, uint64_t deadline_ns) {
+    const std::string list_path = enc->profile.file + ".parts.txt";
+    FILE *list = fopen(list_path.c_str(), "w");
+    if (!list) {
+        sr_log("[encoder] cannot write %s: %s\n", list_path.c_str(), strerror(errno));
+        return;
+    }
+    uint64_t present = 0;
+    for (uint64_t segment = 0; segment < segments; segment++) {
+        const std::string path = segment_path(enc, segment);
+        if (access(path.c_str(), R_OK) == 0) {
+            // The concat demuxer resolves entries relative to the list, which sits next to them.
+            const std::string name = path.substr(path.find_last_of('/') + 1);
+            fprintf(list, "file %s\n", concat_quote(ffmpeg_path(name)).c_str());
+            present++;
+        }
+    }
+    fclose(list);
+
+    int status = -1;
+    if (deadline_ns && now_ns() >= deadline_ns) {
+        sr_log("[encoder] %s: stop timeout reached before joining segments\n",
+               enc->profile.file.c_str());
+    } else if (present) {
+        const pid_t pid = spawn_ffmpeg({"ffmpeg", "-nostdin", "-y", "-loglevel", "error", "-f",
+                                        "concat", "-safe", "0", "-i", ffmpeg_path(list_path),
+                                        "-c", "copy", "-movflags", "+faststart",
+                                        ffmpeg_path(enc->profile.file)},
+                                       nullptr, nullptr);
+        if (pid > 0)
+            status = wait_concat(pid, deadline_ns);
+    }
+    if (status == 0) {
+        for (uint64_t segment = 0; segment < segments; segment++)
+            unlink(segment_path(enc, segment).c_str());
+        unlink(list_path.c_str());
+    } else {
+        sr_log("[encoder] concatenating %s failed, segments kept in %s\n",
+               enc->profile.file.c_str(), list_path.c_str());
+    }
+    sr_log("[encoder] %s: joined %lu segments\n", enc->profile.file.c_str(),
+           (unsigned long) present);
+}
+
+bool encoder_start(encoder *enc, const output_profile *profile, frame_pool *pool,
+                   uint32_t max_queue) {
+    enc->profile = *profile;
+    enc->pool = pool;
+    enc->segment_frames = profile->workers > 1 || profile->adaptive
+                                  ? profile->segment_seconds * profile->fps
+                                  : 0;
+    enc->max_queue = std::max(1u, max_queue);
+
+    for (uint32_t i = 0; i < profile->workers; i++) {
+        auto *w = new encoder_worker{};
+        w->enc = enc;
+        enc->workers.push_back(w);
+    }
+    // A continuous encode starts right away so a broken ffmpeg shows up before capture does.
+    if (!enc->segment_frames && !start_process(enc->workers[0], profile->file))
+        return false;
+
+    char mode[96] = "";
+    int length = 0;
+    if (enc->segment_frames)
+        length = snprintf(mode, sizeof(mode), ", %u workers on %us segments", profile->workers,
+                          profile->segment_seconds);
+    if (profile->adaptive && profile->cpu_budget > 0)
+        snprintf(mode + length, sizeof(mode) - length, ", adaptive within %.1f cores",
+                 profile->cpu_budget);
+    else if (profile->adaptive)
+        snprintf(mode + length, sizeof(mode) - length, ", adaptive");
+    sr_log("[encoder] %s: %ux%u from %ux%u, preset %s, crf %d%s\n", profile->file.c_str(),
+           profile->width ? profile->width : pool->width,
+           profile->height ? profile->height : pool->height, pool->width, pool->height,
+           profile->preset.c_str(), profile->crf, mode);
+
+    for (encoder_worker *w : enc->workers)
+        w->thread = std::thread(writer_loop, w);
+    return true;
+}
+
+// Keeps frames on a grid of 1/fps, so the file plays back in real time whatever the capture
+// rate; a capture slower than fps keeps every frame. every= counts frames instead.
+// Waits for the writers to make room when the encoder is blocking; false means drop.
+static bool wait_for_space(encoder *enc) {
+    std::unique_lock guard(enc->space_lock);
+    // encoder_block may change the deadline meanwhile, so it is read again after every wake.
+    for (;;) {
+        if (enc->queued < enc->max_queue)
+            return true;
+        const uint64_t deadline = enc->block_deadline_ns;
+        if (!enc->blocking || (deadline && now_ns() >= deadline))
+            return false;
+        if (!deadline)
+            enc->space.wait(guard);
+        else
+            enc->space.wait_until(guard, std::chrono::steady_clock::time_point(
+                                                 std::chrono::nanoseconds(deadline)));
+    }
+}
+
+static bool keep_frame(encoder *enc, uint64_t pts_ns) {
+    const output_profile &profile = enc->profile;
+    if (profile.every)
+        return enc->offered++ % profile.every == 0;
+
+    const uint64_t period = 1000000000ull / profile.fps;
+    // A quarter period of slack absorbs capture jitter around the grid.
+    if (enc->next_pts_ns && pts_ns + period / 4 < enc->next_pts_ns)
+        return false;
+    // After a gap in the capture the grid restarts at this frame.
+    const bool on_grid = enc->next_pts_ns && pts_ns < enc->next_pts_ns + period;
+    enc->next_pts_ns = (on_grid ? enc->next_pts_ns : pts_ns) + period;
+    return true;
+}
+
+void encoder_submit(encoder *enc, uint8_t *data, uint64_t pts_ns,
+                    const activity_sample *activity) {
+    const uint64_t segment = enc->segment_frames ? enc->accepted / enc->segment_frames : 0;
+    if (enc->profile.adaptive && segment != enc->window_segment) {
+        // The segment starting now is encoded with what the previous one looked like.
+        const activity_window &window = enc->window;
+        enc->activity.content = activity_classify(&window);
+        enc->activity.changed = window.frames ? window.changed / window.frames : 0;
+        enc->activity.scrolled = window.frames ? (float) window.scrolled / window.frames : 0;
+        enc->window = {};
+        enc->window_segment = segment;
+    }
+    if (enc->profile.adaptive && activity)
+        activity_add(&enc->window, activity);
+    if (!keep_frame(enc, pts_ns))
+        return;
+
+    // Only this thread adds to queued, so the check cannot be overtaken.
+    if (enc->queued >= enc->max_queue && !wait_for_space(enc)) {
+        enc->dropped++;
+        return;
+    }
+    enc->queued++;
+
+    encoder_worker *w = enc->workers[segment % enc->workers.size()];
+    {
+        std::lock_guard guard(w->lock);
+        frame_pool_ref(enc->pool, data);
+        w->queue.push_back({data, segment, enc->activity});
+    }
+    enc->accepted++;
+    w->cv.notify_one();
+}
+
+void encoder_block(encoder *enc, uint64_t deadline_ns) {
+    {
+        std::lock_guard guard(enc->space_lock);
+        enc->blocking = true;
+        enc->block_deadline_ns = deadline_ns;
+    }
+    enc->space.notify_all();
+}
+
+void encoder_stop(encoder *enc, uint64_t drain_deadline_ns, uint64_t deadline_ns) {
+    enc->stop_deadline_ns = drain_deadline_ns;
+    for (encoder_worker *w : enc->workers) {
+        {
+            std::lock_guard guard(w->lock);
+            w->stopping = true;
+        }
+        w->cv.notify_all();
+    }
+
+    const uint64_t kill_deadline_ns =
+            deadline_ns ? drain_deadline_ns + (deadline_ns - drain_deadline_ns) / 2 : 0;
+    for (encoder_worker *w : enc->workers) {
+        if (wait_done(w, drain_deadline_ns))
+            continue;
+        // ffmpeg finalises its file on SIGINT; the writer then sees EPIPE and drops the rest.
+        if (signal_processes(w, SIGINT) && !enc->discard)
+            sr_log("[encoder] %s: stop deadline reached, interrupting ffmpeg\n",
+                   enc->profile.file.c_str());
+        if (!wait_done(w, kill_deadline_ns))
+            signal_processes(w, SIGKILL);
+    }
+    for (encoder_worker *w : enc->workers) {
+        if (w->thread.joinable())
+            w->thread.join();
+        finish_process(w);
+    }
+
+    if (enc->discard)
+        return;
+    sr_log("[encoder] %s: encoded %lu frames, dropped %lu\n", enc->profile.file.c_str(),
+           (unsigned long) enc->encoded.load(), (unsigned long) enc->dropped.load());
+    if (enc->profile.adaptive)
+        report_adaptive(enc);
+    if (enc->segment_frames && enc->accepted)
+        concat_segments(enc, (enc->accepted + enc->segment_frames - 1) / enc->segment_frames,
+                        deadline_ns);
+}
+
+void encoder_destroy(encoder *enc) {
+    for (encoder_worker *w : enc->workers)
+        delete w;
+    enc->workers.clear();
+}
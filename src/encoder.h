@@ -0,0 +1,151 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <sys/types.h>
+#include <thread>
+#include <vector>
+
+#include "activity.h"
+#include "frame-pool.h"
+#include "recorder.h"
+#include "stats.h"
+#include "thread-policy.h"
+
+// Feeds pool frames to ffmpeg children on dedicated writer threads, so a slow encoder never
+// stalls the PipeWire loop. Frames are returned to the pool once written.
+//
+// With more than one worker the stream is cut into segments of segment_seconds. Each segment
+// is an independent (hence closed-GOP) encode, segments go round-robin to the workers and are
+// concatenated in order into the output file when the encoder stops.
+//
+// Adaptive outputs are always segmented. Each segment's preset, CRF and keyframe interval
+// follow the screen activity measured over the segment before it, and a class whose measured
+// encoder CPU exceeds cpu_budget, when one is set, steps to a faster preset. A finished
+// segment's ffmpeg completes its file in the background, so a worker moves on to the next
+// segment without waiting for it.
+
+// Parses "size=WxH,fps=N,every=N,crf=N,preset=NAME,workers=N,segment=SECONDS,adaptive=0|1,
+// budget=CORES,file=PATH"; only file= is required.
+bool output_profile_parse(const char *arg, output_profile *profile);
+
+// Frames an output may hold queued or being written: pool_frames of slack plus what it has
+// to buffer while a segment waits for a busy worker.
+uint32_t output_profile_backlog(const output_profile *profile, uint32_t pool_frames);
+
+// Activity of the window an adaptive segment's settings are chosen from.
+struct segment_activity {
+    content_class content;
+    float changed;
+    float scrolled;
+};
+
+struct encoder_settings {
+    segment_activity activity;
+    const char *preset;
+    int crf;
+    uint32_t keyint;
+};
+
+struct encoder_frame {
+    uint8_t *data;
+    uint64_t segment;
+    segment_activity activity;
+};
+
+struct adaptive_totals {
+    uint32_t segments = 0;
+    double cpu_seconds = 0;
+    double video_seconds = 0;
+    uint64_t bytes = 0;
+};
+
+// A segment's ffmpeg whose input is closed, still finishing its file.
+struct retired_segment {
+    pid_t pid;
+    int64_t segment;
+    uint64_t written;
+    encoder_settings settings;
+};
+
+struct encoder;
+
+struct encoder_worker {
+    encoder *enc = nullptr;
+    int fd = -1;
+    std::atomic<pid_t> pid{-1};
+    int64_t segment = -1;
+    uint64_t written = 0; // frames in the current segment
+    encoder_settings settings{};
+
+    std::thread thread;
+    std::mutex lock;
+    std::condition_variable cv;
+    std::deque<encoder_frame> queue;
+    std::vector<retired_segment> retired; // reaped by the writer, signalled by encoder_stop
+    bool stopping = false;
+    bool done = false;
+};
+
+struct encoder {
+    const thread_policy *writer_policy = nullptr;
+    const thread_policy *process_policy = nullptr;
+    sched_placements *placements = nullptr;
+
+    output_profile profile;
+    frame_pool *pool = nullptr;
+    uint32_t max_queue = 0;          // frames this output may hold, over all its workers
+    std::atomic<uint32_t> queued{0}; // queued or being written
+    uint32_t segment_frames = 0;     // 0 for a single continuous encode
+    uint64_t offered = 0;
+    uint64_t accepted = 0;
+    uint64_t next_pts_ns = 0; // next slot on the output's frame grid
+    std::atomic<uint64_t> encoded{0};
+    std::atomic<uint64_t> dropped{0}; // by this output, because it fell behind
+    std::atomic<uint64_t> stop_deadline_ns{0};
+    bool discard = false; // output thrown away (calibration): stopped quietly, never joined
+
+    // While blocking, a submit that finds the output full waits for room until
+    // block_deadline_ns instead of dropping.
+    std::mutex space_lock;
+    std::condition_variable space;
+    bool blocking = false;
+    uint64_t block_deadline_ns = 0;
+
+    // Adaptive state. The window is filled by the submitting thread; the rest is shared by
+    // the workers under adaptive_lock.
+    activity_window window;
+    segment_activity activity{CONTENT_UNKNOWN, 0.0f, 0.0f};
+    uint64_t window_segment = 0;
+    std::mutex adaptive_lock;
+    int preset_step[CONTENT_CLASS_COUNT] = {};
+    adaptive_totals totals[CONTENT_CLASS_COUNT];
+
+    std::vector<encoder_worker *> workers;
+};
+
+// Whether ffmpeg is found in PATH, where every encoder runs it from.
+bool encoder_available();
+
+// The output holds at most max_queue frames of the pool, queued or being written; further
+// frames are dropped for this output only.
+bool encoder_start(encoder *enc, const output_profile *profile, frame_pool *pool,
+                   uint32_t max_queue);
+// Queues a pool frame for this output, taking a reference on it. Frames skipped to match the
+// profile's fps (or every) or dropped because this output is behind are not referenced.
+// activity is the frame's difference statistics, or nullptr when nothing was measured.
+void encoder_submit(encoder *enc, uint8_t *data, uint64_t pts_ns,
+                    const activity_sample *activity);
+// From now on submits wait for room until deadline_ns (CLOCK_MONOTONIC, 0 for no limit)
+// rather than drop, for draining at stop. A submit already waiting picks up the new deadline.
+void encoder_block(encoder *enc, uint64_t deadline_ns);
+// Writes out every queued frame and lets ffmpeg finalise its file. Frames still queued at
+// drain_deadline_ns are dropped and ffmpeg is interrupted, then killed halfway to
+// deadline_ns; segments are joined only while deadline_ns has not passed. 0 for no limit.
+// With discard set none of that is reported and segments are left unjoined.
+void encoder_stop(encoder *enc, uint64_t drain_deadline_ns, uint64_t deadline_ns);
+void encoder_destroy(encoder *enc);
@@ -0,0 +1,335 @@
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "frame-bus.h"
+#include "log.h"
+
+#ifndef F_SEAL_FUTURE_WRITE
+#define F_SEAL_FUTURE_WRITE 0x0010
+#endif
+
+static constexpr size_t page_size = 4096;
+
+static size_t align_up(size_t value, size_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+static long futex(const std::atomic<uint32_t> *addr, int op, uint32_t val,
+                  const timespec *timeout) {
+    // The word lives in a MAP_SHARED mapping used by several processes, so the
+    // non-private futex ops are required here.
+    return syscall(SYS_futex, addr, op, val, timeout, nullptr, 0);
+}
+
+static int bind_socket(const char *path) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        sr_log("[framebus] socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+
+    unlink(path);
+    if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0 || listen(fd, 8) < 0) {
+        sr_log("[framebus] cannot listen on %s: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void send_memfd(int client_fd, int memfd) {
+    char tag = 'F';
+    iovec iov{&tag, 1};
+
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))]{};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &memfd, sizeof(int));
+
+    if (sendmsg(client_fd, &msg, MSG_NOSIGNAL) < 0)
+        sr_log("[framebus] failed to hand out memfd: %s\n", strerror(errno));
+}
+
+static void accept_loop(frame_bus *bus) {
+    for (;;) {
+        int client_fd = accept4(bus->listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client_fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            return; // listening socket was shut down
+        }
+        send_memfd(client_fd, bus->readonly_fd);
+        close(client_fd);
+        sr_log("[framebus] consumer attached\n");
+    }
+}
+
+bool frame_bus_create(frame_bus *bus, const char *socket_path, uint32_t width, uint32_t height,
+                      uint32_t stride, uint32_t format, uint32_t slot_count) {
+    const size_t slot_size = align_up(static_cast<size_t>(stride) * height, page_size);
+    if (slot_count == 0)
+        slot_count = static_cast<uint32_t>(std::clamp<size_t>(
+                FRAME_BUS_DEFAULT_BYTES / slot_size, FRAME_BUS_MIN_SLOTS, FRAME_BUS_MAX_SLOTS));
+    slot_count = std::min(slot_count, FRAME_BUS_MAX_SLOTS);
+
+    const size_t data_offset = align_up(sizeof(frame_bus_header), page_size);
+    bus->map_size = data_offset + slot_size * slot_count;
+
+    bus->memfd = memfd_create("sr-frame-bus", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (bus->memfd < 0 || ftruncate(bus->memfd, static_cast<off_t>(bus->map_size)) < 0) {
+        sr_log("[framebus] cannot create memfd: %s\n", strerror(errno));
+        frame_bus_destroy(bus);
+        return false;
+    }
+    void *map = mmap(nullptr, bus->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, bus->memfd, 0);
+    if (map == MAP_FAILED) {
+        sr_log("[framebus] cannot map memfd: %s\n", strerror(errno));
+        frame_bus_destroy(bus);
+        return false;
+    }
+    bus->header = static_cast<frame_bus_header *>(map);
+    bus->data = static_cast<uint8_t *>(map) + data_offset;
+
+    // Our mapping stays writable, but nobody can write or map the memfd writable from now on,
+    // not even a consumer that reopens its descriptor read-write through /proc.
+    if (fcntl(bus->memfd, F_ADD_SEALS,
+              F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_FUTURE_WRITE | F_SEAL_SEAL) < 0) {
+        sr_log("[framebus] cannot seal memfd: %s\n", strerror(errno));
+        frame_bus_destroy(bus);
+        return false;
+    }
+
+    // Consumers get a descriptor opened read-only on top of that.
+    char proc_path[64];
+    snprintf(proc_path, sizeof(proc_path), "/proc/self/fd/%d", bus->memfd);
+    bus->readonly_fd = open(proc_path, O_RDONLY | O_CLOEXEC);
+    if (bus->readonly_fd < 0) {
+        sr_log("[framebus] cannot reopen memfd read-only: %s\n", strerror(errno));
+        frame_bus_destroy(bus);
+        return false;
+    }
+
+    frame_bus_header *h = bus->header;
+    h->width = width;
+    h->height = height;
+    h->stride = stride;
+    h->format = format;
+    h->slot_count = slot_count;
+    h->slot_size = slot_size;
+    h->data_offset = data_offset;
+    h->version = FRAME_BUS_VERSION;
+    std::atomic_thread_fence(std::memory_order_release);
+    h->magic = FRAME_BUS_MAGIC;
+
+    bus->listen_fd = bind_socket(socket_path);
+    if (bus->listen_fd < 0) {
+        frame_bus_destroy(bus);
+        return false;
+    }
+    bus->socket_path = socket_path;
+    bus->acceptor = std::thread(accept_loop, bus);
+
+    sr_log("[framebus] publishing %ux%u frames in %u slots on %s\n", width, height, slot_count,
+           socket_path);
+    return true;
+}
+
+void frame_bus_publish(frame_bus *bus, const void *frame, uint32_t stride, uint64_t pts_ns) {
+    frame_bus_header *h = bus->header;
+    if (!h)
+        return;
+
+    const uint64_t index = h->published.load(std::memory_order_relaxed);
+    frame_bus_slot &slot = h->slots[index % h->slot_count];
+    const uint32_t size = h->stride * h->height;
+
+    const uint32_t seq = slot.seq.load(std::memory_order_relaxed);
+    slot.seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    uint8_t *dst = bus->data + (index % h->slot_count) * h->slot_size;
+    if (stride == h->stride) {
+        memcpy(dst, frame, size);
+    } else {
+        // Padded source rows are packed to the bus stride.
+        const auto *src = static_cast<const uint8_t *>(frame);
+        for (uint32_t y = 0; y < h->height; y++)
+            memcpy(dst + static_cast<size_t>(y) * h->stride,
+                   src + static_cast<size_t>(y) * stride, h->stride);
+    }
+    slot.size = size;
+    slot.frame_index = index;
+    slot.pts_ns = pts_ns;
+
+    slot.seq.store(seq + 2, std::memory_order_release);
+    h->published.store(index + 1, std::memory_order_release);
+    h->futex.fetch_add(1, std::memory_order_release);
+    futex(&h->futex, FUTEX_WAKE, INT_MAX, nullptr);
+}
+
+void frame_bus_destroy(frame_bus *bus) {
+    if (bus->listen_fd >= 0) {
+        shutdown(bus->listen_fd, SHUT_RDWR);
+        if (bus->acceptor.joinable())
+            bus->acceptor.join();
+        close(bus->listen_fd);
+        bus->listen_fd = -1;
+        unlink(bus->socket_path.c_str());
+    }
+    if (bus->header) {
+        munmap(bus->header, bus->map_size);
+        bus->header = nullptr;
+        bus->data = nullptr;
+    }
+    if (bus->readonly_fd >= 0) {
+        close(bus->readonly_fd);
+        bus->readonly_fd = -1;
+    }
+    if (bus->memfd >= 0) {
+        close(bus->memfd);
+        bus->memfd = -1;
+    }
+}
+
+/* ------------------------------------------------- */
+
+static int receive_memfd(int sock_fd) {
+    char tag;
+    iovec iov{&tag, 1};
+
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))]{};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    if (recvmsg(sock_fd, &msg, MSG_CMSG_CLOEXEC) <= 0)
+        return -1;
+
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+        return -1;
+
+    int fd;
+    memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+    return fd;
+}
+
+bool frame_bus_attach(frame_bus_view *view, const char *socket_path) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path))
+        return false;
+    strcpy(addr.sun_path, socket_path);
+
+    int sock_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock_fd < 0)
+        return false;
+    if (connect(sock_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+        sr_log("[framebus] cannot connect to %s: %s\n", socket_path, strerror(errno));
+        close(sock_fd);
+        return false;
+    }
+    view->fd = receive_memfd(sock_fd);
+    close(sock_fd);
+    if (view->fd < 0) {
+        sr_log("[framebus] no memfd received from %s\n", socket_path);
+        return false;
+    }
+
+    const off_t size = lseek(view->fd, 0, SEEK_END);
+    void *map = size > 0 ? mmap(nullptr, size, PROT_READ, MAP_SHARED, view->fd, 0) : MAP_FAILED;
+    if (map == MAP_FAILED) {
+        frame_bus_detach(view);
+        return false;
+    }
+    view->map_size = size;
+    view->header = static_cast<const frame_bus_header *>(map);
+    if (view->header->magic != FRAME_BUS_MAGIC || view->header->version != FRAME_BUS_VERSION) {
+        sr_log("[framebus] unexpected frame bus layout\n");
+        frame_bus_detach(view);
+        return false;
+    }
+    view->data = static_cast<const uint8_t *>(map) + view->header->data_offset;
+    return true;
+}
+
+void frame_bus_detach(frame_bus_view *view) {
+    if (view->header) {
+        munmap(const_cast<frame_bus_header *>(view->header), view->map_size);
+        view->header = nullptr;
+        view->data = nullptr;
+    }
+    if (view->fd >= 0) {
+        close(view->fd);
+        view->fd = -1;
+    }
+}
+
+uint64_t frame_bus_wait(const frame_bus_view *view, uint64_t seen, int timeout_ms) {
+    const frame_bus_header *h = view->header;
+    const uint32_t word = h->futex.load(std::memory_order_acquire);
+    const uint64_t published = h->published.load(std::memory_order_acquire);
+    if (published > seen)
+        return published;
+
+    timespec timeout{timeout_ms / 1000, (timeout_ms % 1000) * 1000000L};
+    futex(&h->futex, FUTEX_WAIT, word, timeout_ms < 0 ? nullptr : &timeout);
+    return h->published.load(std::memory_order_acquire);
+}
+
+bool frame_bus_read_latest(const frame_bus_view *view, void *dst, size_t dst_size,
+                           frame_bus_frame *out) {
+    const frame_bus_header *h = view->header;
+
+    for (int attempt = 0; attempt < 4; attempt++) {
+        const uint64_t published = h->published.load(std::memory_order_acquire);
+        if (published == 0)
+            return false;
+
+        const uint64_t index = published - 1;
+        const frame_bus_slot &slot = h->slots[index % h->slot_count];
+        const uint32_t seq_before = slot.seq.load(std::memory_order_acquire);
+        if (seq_before & 1u)
+            continue;
+
+        const frame_bus_frame frame{slot.frame_index, slot.pts_ns, slot.size};
+        if (frame.frame_index != index)
+            continue;
+        memcpy(dst, view->data + (index % h->slot_count) * h->slot_size,
+               frame.size < dst_size ? frame.size : dst_size);
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.seq.load(std::memory_order_relaxed) == seq_before) {
+            if (out)
+                *out = frame;
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+// Shared-memory frame bus. The recorder publishes every captured frame into a ring of slots
+// inside a memfd; local consumers connect to a Unix socket, receive a read-only descriptor of
+// that memfd over SCM_RIGHTS and map it. The memfd is sealed against writes once the producer
+// mapped it, so no consumer can map it writable. The producer never waits for consumers: a slot
+// that is overwritten while a consumer reads it is detected through the slot sequence number.
+
+#define FRAME_BUS_MAGIC 0x42465253u // "SRFB"
+#define FRAME_BUS_VERSION 1u
+#define FRAME_BUS_MAX_SLOTS 16u
+#define FRAME_BUS_MIN_SLOTS 3u
+// Ring size the default slot count is derived from: 16 slots at 1080p, 4 at 4K.
+#define FRAME_BUS_DEFAULT_BYTES (128u * 1024 * 1024)
+
+struct frame_bus_slot {
+    std::atomic<uint32_t> seq; // odd while the producer writes the slot
+    uint32_t size;
+    uint64_t frame_index;
+    uint64_t pts_ns;
+};
+
+struct frame_bus_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;
+    uint32_t format; // spa_video_format of the slot data
+    uint32_t slot_count;
+    std::atomic<uint32_t> futex; // bumped on every publish, consumers FUTEX_WAIT on it
+    uint64_t slot_size;
+    uint64_t data_offset;
+    std::atomic<uint64_t> published; // number of complete frames published so far
+    frame_bus_slot slots[FRAME_BUS_MAX_SLOTS];
+};
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free);
+static_assert(std::atomic<uint64_t>::is_always_lock_free);
+
+/* ------------------------------------------------- */
+
+struct frame_bus {
+    int memfd = -1;
+    int readonly_fd = -1;
+    int listen_fd = -1;
+
+    frame_bus_header *header = nullptr;
+    uint8_t *data = nullptr;
+    size_t map_size = 0;
+
+    std::string socket_path;
+    std::thread acceptor;
+};
+
+// slot_count 0 sizes the ring to about FRAME_BUS_DEFAULT_BYTES.
+bool frame_bus_create(frame_bus *bus, const char *socket_path, uint32_t width, uint32_t height,
+                      uint32_t stride, uint32_t format, uint32_t slot_count);
+// frame holds height rows, stride bytes apart; the slot keeps the bus stride's worth of each.
+void frame_bus_publish(frame_bus *bus, const void *frame, uint32_t stride, uint64_t pts_ns);
+void frame_bus_destroy(frame_bus *bus);
+
+/* ------------------------------------------------- */
+
+struct frame_bus_view {
+    int fd = -1;
+    const frame_bus_header *header = nullptr;
+    const uint8_t *data = nullptr;
+    size_t map_size = 0;
+};
+
+struct frame_bus_frame {
+    uint64_t frame_index;
+    uint64_t pts_ns;
+    uint32_t size;
+};
+
+bool frame_bus_attach(frame_bus_view *view, const char *socket_path);
+void frame_bus_detach(frame_bus_view *view);
+
+// Blocks until a frame newer than `seen` is published or timeout_ms elapses.
+// Returns the current publish count.
+uint64_t frame_bus_wait(const frame_bus_view *view, uint64_t seen, int timeout_ms);
+
+// Copies the newest frame into dst. Returns false when nothing was published yet or the slot
+// was overwritten during the copy more often than the retry budget allows.
+bool frame_bus_read_latest(const frame_bus_view *view, void *dst, size_t dst_size,
+                           frame_bus_frame *out);
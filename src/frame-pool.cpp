@@ -0,0 +1,155 @@
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "frame-pool.h"
+#include "log.h"
+
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+
+static size_t align_up(size_t value, size_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+static uint8_t *map_huge_pages(size_t size) {
+    void *map = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+    return map == MAP_FAILED ? nullptr : static_cast<uint8_t *>(map);
+}
+
+static uint8_t *map_transparent_huge_pages(size_t size) {
+    // Over-allocate so the usable range can start on a huge page boundary, which is what
+    // lets khugepaged and the fault path back it with 2 MB pages.
+    const size_t padded = size + FRAME_POOL_HUGE_PAGE_SIZE;
+    void *map = mmap(nullptr, padded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED)
+        return nullptr;
+
+    auto *raw = static_cast<uint8_t *>(map);
+    auto *aligned = reinterpret_cast<uint8_t *>(
+            align_up(reinterpret_cast<uintptr_t>(raw), FRAME_POOL_HUGE_PAGE_SIZE));
+    if (aligned > raw)
+        munmap(raw, aligned - raw);
+    if (const size_t tail = raw + padded - (aligned + size))
+        munmap(aligned + size, tail);
+
+    madvise(aligned, size, MADV_HUGEPAGE);
+
+    // Populate only after the advice, otherwise the range is faulted in with small pages.
+    if (madvise(aligned, size, MADV_POPULATE_WRITE) != 0) {
+        const long page = sysconf(_SC_PAGESIZE);
+        for (size_t off = 0; off < size; off += page)
+            aligned[off] = 0;
+    }
+    return aligned;
+}
+
+uint32_t frame_pool_stride(uint32_t width, uint32_t bytes_per_pixel) {
+    return align_up(static_cast<size_t>(width) * bytes_per_pixel, FRAME_POOL_STRIDE_ALIGN);
+}
+
+bool frame_pool_init(frame_pool *pool, frame_format format, uint32_t width, uint32_t height,
+                     uint32_t count) {
+    pool->format = format;
+    pool->width = width;
+    pool->height = height;
+    size_t bytes;
+    if (format == FRAME_FORMAT_I420) {
+        pool->stride = frame_pool_stride(width, 1);
+        pool->uv_stride = frame_pool_stride((width + 1) / 2, 1);
+        bytes = static_cast<size_t>(pool->stride) * height +
+                2 * static_cast<size_t>(pool->uv_stride) * ((height + 1) / 2);
+    } else {
+        pool->stride = frame_pool_stride(width, 4);
+        bytes = static_cast<size_t>(pool->stride) * height;
+    }
+    pool->frame_size = align_up(bytes, 4096);
+    pool->count = count;
+    pool->map_size = align_up(pool->frame_size * count, FRAME_POOL_HUGE_PAGE_SIZE);
+
+    pool->base = map_huge_pages(pool->map_size);
+    pool->huge_pages = pool->base != nullptr;
+    if (!pool->base)
+        pool->base = map_transparent_huge_pages(pool->map_size);
+    if (!pool->base) {
+        sr_log("[framepool] cannot allocate %zu bytes: %s\n", pool->map_size, strerror(errno));
+        return false;
+    }
+
+    pool->refs.assign(count, 0);
+    pool->free_frames.clear();
+    pool->free_frames.reserve(count);
+    for (uint32_t i = count; i > 0; i--)
+        pool->free_frames.push_back(pool->base + (i - 1) * pool->frame_size);
+
+    sr_log("[framepool] %u %s frames of %ux%u (stride %u), %.1f MB backed by %s\n", count,
+           format == FRAME_FORMAT_I420 ? "I420" : "BGRA", width, height, pool->stride,
+           pool->map_size / (1024.0 * 1024.0),
+           pool->huge_pages ? "hugetlb pages" : "transparent huge pages");
+    return true;
+}
+
+void frame_pool_destroy(frame_pool *pool) {
+    if (pool->base) {
+        munmap(pool->base, pool->map_size);
+        pool->base = nullptr;
+    }
+    std::lock_guard guard(pool->lock);
+    pool->free_frames.clear();
+}
+
+static uint8_t *take_frame(frame_pool *pool) {
+    uint8_t *frame = pool->free_frames.back();
+    pool->free_frames.pop_back();
+    pool->refs[(frame - pool->base) / pool->frame_size] = 1;
+    return frame;
+}
+
+uint8_t *frame_pool_acquire(frame_pool *pool) {
+    std::lock_guard guard(pool->lock);
+    return pool->free_frames.empty() ? nullptr : take_frame(pool);
+}
+
+uint8_t *frame_pool_acquire_until(frame_pool *pool, uint64_t deadline_ns) {
+    std::unique_lock guard(pool->lock);
+    const auto available = [pool] { return !pool->free_frames.empty(); };
+    if (!deadline_ns) {
+        pool->released.wait(guard, available);
+    } else {
+        const auto until =
+                std::chrono::steady_clock::time_point(std::chrono::nanoseconds(deadline_ns));
+        if (!pool->released.wait_until(guard, until, available))
+            return nullptr;
+    }
+    return take_frame(pool);
+}
+
+void frame_pool_ref(frame_pool *pool, uint8_t *frame) {
+    std::lock_guard guard(pool->lock);
+    pool->refs[(frame - pool->base) / pool->frame_size]++;
+}
+
+void frame_pool_release(frame_pool *pool, uint8_t *frame) {
+    std::lock_guard guard(pool->lock);
+    if (--pool->refs[(frame - pool->base) / pool->frame_size] == 0) {
+        pool->free_frames.push_back(frame);
+        pool->released.notify_one();
+    }
+}
+
+i420_planes frame_pool_i420(const frame_pool *pool, uint8_t *frame) {
+    i420_planes planes{};
+    planes.y = frame;
+    planes.u = frame + static_cast<size_t>(pool->stride) * pool->height;
+    planes.v = planes.u + static_cast<size_t>(pool->uv_stride) * ((pool->height + 1) / 2);
+    planes.y_stride = pool->stride;
+    planes.uv_stride = pool->uv_stride;
+    planes.width = pool->width;
+    planes.height = pool->height;
+    return planes;
+}
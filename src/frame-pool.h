@@ -0,0 +1,58 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "convert.h"
+
+// Fixed set of frame buffers allocated once per session from the negotiated geometry.
+// The backing memory comes from explicit huge pages when the system has them reserved,
+// otherwise from a 2 MB aligned anonymous mapping advised for transparent huge pages.
+// Every buffer is pre-faulted so the capture path never takes page faults on it.
+
+#define FRAME_POOL_STRIDE_ALIGN 64
+#define FRAME_POOL_HUGE_PAGE_SIZE (2u * 1024 * 1024)
+
+enum frame_format {
+    FRAME_FORMAT_BGRA,
+    FRAME_FORMAT_I420, // Y, U and V planes back to back, each with an aligned stride
+};
+
+struct frame_pool {
+    uint8_t *base = nullptr;
+    size_t map_size = 0;
+
+    frame_format format = FRAME_FORMAT_BGRA;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t stride = 0;    // stride of the first plane
+    uint32_t uv_stride = 0; // I420 only
+    size_t frame_size = 0;  // distance between buffers, page aligned
+    uint32_t count = 0;
+    bool huge_pages = false;
+
+    std::mutex lock;
+    std::condition_variable released; // a buffer went back to free_frames
+    std::vector<uint8_t *> free_frames;
+    std::vector<uint32_t> refs;
+};
+
+uint32_t frame_pool_stride(uint32_t width, uint32_t bytes_per_pixel);
+
+bool frame_pool_init(frame_pool *pool, frame_format format, uint32_t width, uint32_t height,
+                     uint32_t count);
+void frame_pool_destroy(frame_pool *pool);
+
+// Returns nullptr when every buffer is in flight; callers drop the frame in that case.
+// A buffer starts with one reference and goes back to the pool when the last one is released.
+uint8_t *frame_pool_acquire(frame_pool *pool);
+// Waits for a buffer to come back until deadline_ns (CLOCK_MONOTONIC, 0 for no limit).
+uint8_t *frame_pool_acquire_until(frame_pool *pool, uint64_t deadline_ns);
+void frame_pool_ref(frame_pool *pool, uint8_t *frame);
+void frame_pool_release(frame_pool *pool, uint8_t *frame);
+
+// Plane pointers and strides of an I420 pool frame.
+i420_planes frame_pool_i420(const frame_pool *pool, uint8_t *frame);
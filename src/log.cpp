@@ -0,0 +1,36 @@
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+
+#include "log.h"
+
+static std::mutex handler_lock;
+static std::function<void(const char *line)> log_handler;
+
+void sr_log_set_handler(std::function<void(const char *line)> handler) {
+    std::lock_guard guard(handler_lock);
+    log_handler = std::move(handler);
+}
+
+void sr_log(const char *format, ...) {
+    char line[1024];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    const size_t length = strlen(line);
+    if (length && line[length - 1] == '\n')
+        line[length - 1] = '\0';
+
+    // Called from capture, pipeline and writer threads alike; the handler runs unlocked.
+    std::function<void(const char *line)> handler;
+    {
+        std::lock_guard guard(handler_lock);
+        handler = log_handler;
+    }
+    if (handler)
+        handler(line);
+    else
+        fprintf(stderr, "%s\n", line);
+}
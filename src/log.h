@@ -0,0 +1,10 @@
+#pragma once
+
+#include <functional>
+
+// Library diagnostics. Every call is one line, handed to the handler installed with
+// sr_log_set_handler (recorder_set_log_handler in the public API), or written to stderr when
+// there is none. A trailing newline in the format is dropped.
+
+void sr_log(const char *format, ...) __attribute__((format(printf, 1, 2)));
+void sr_log_set_handler(std::function<void(const char *line)> handler);
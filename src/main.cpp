@@ -1,30 +1,68 @@
+#include <atomic>
 #include <iostream>
+#include <csignal>
 #include <glib.h>
-#include "screencast-portal.hpp"
-#include "pipewire.h"
+#include <glib-unix.h>
+#include "recorder.h"
 #include "utils.h"
 
 using namespace std;
 
+// Runs on the main loop rather than in signal context, so shutdown can take locks and join.
+static gboolean on_stop_signal(gpointer data) {
+    g_main_loop_quit(static_cast<GMainLoop *>(data));
+    return G_SOURCE_REMOVE;
+}
+
+static recorder_config config_from_options() {
+    recorder_config config;
+    config.input_fps_num = SROptions::inputFpsNum;
+    config.input_fps_den = SROptions::inputFpsDen;
+    config.pipewire_node = SROptions::pipewireNode;
+    config.pipewire_remote = SROptions::pipewireRemote;
+    config.pw_buffers = SROptions::pwBuffers;
+    config.pool_frames = SROptions::poolFrames;
+    for (int role = 0; role < SR_ROLE_COUNT; role++)
+        config.thread_policies[role] = SROptions::threadPolicies[role];
+    config.frame_bus_path = SROptions::frameBusPath;
+    config.outputs = SROptions::outputs;
+    config.stop_timeout_ms = SROptions::stopTimeoutMs;
+    config.calibrate = SROptions::calibrate;
+    config.recalibrate = SROptions::recalibrate;
+    return config;
+}
+
 int main(int argc, char *argv[]) {
     parse_cli(argc, argv);
 
     GMainLoop *loop = g_main_loop_new(nullptr, FALSE);
     cout << "[SR] screen record starting" << endl;
-    const auto capture = static_cast<struct ScreencastPortalCapture *>(
-        screencast_portal_desktop_capture_create(true));
 
-    signal(SIGINT, handle_sigint);
-    signal(SIGTERM, handle_sigint);
+    // A capture that breaks after starting ends the run like a signal does, but fails it.
+    std::atomic<int> status{0};
+    recorder_config config = config_from_options();
+    // Quit through an idle source: it also works before the loop runs, and from any thread.
+    config.on_error = [loop, &status](const char *) {
+        status = 1;
+        g_idle_add(on_stop_signal, loop);
+    };
+
+    Recorder recorder(config);
+    if (!recorder.start()) {
+        g_main_loop_unref(loop);
+        return 1;
+    }
+
+    g_unix_signal_add(SIGINT, on_stop_signal, loop);
+    g_unix_signal_add(SIGTERM, on_stop_signal, loop);
 
     g_main_loop_run(loop);
 
     cout << "[SR] screen record ending..." << endl;
-    screencast_portal_capture_destroy(capture);
-    screencast_portal_unload();
+    recorder.stop();
     g_main_loop_unref(loop);
     cout << "[SR] screen record ended" << endl;
 
-    return 0;
+    return status;
 
 }
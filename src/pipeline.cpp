@@ -0,0 +1,264 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include "pipeline.h"
+#include "log.h"
+
+// Part of the stop timeout kept back from draining, for ffmpeg to finalise and for joining
+// segments: half of it, at most this much.
+#define STOP_RESERVE_NS 2000000000ull
+
+static uint32_t level_size(uint32_t size, uint32_t level) {
+    for (uint32_t i = 0; i < level; i++)
+        size = (size / 2) & ~1u;
+    return size;
+}
+
+uint32_t pipeline_level(uint32_t width, uint32_t height, const output_profile &profile) {
+    if (profile.width == 0 || profile.height == 0)
+        return 0;
+    uint32_t level = 0;
+    while (level_size(width, level + 1) >= profile.width &&
+           level_size(height, level + 1) >= profile.height && level_size(width, level + 1) >= 2)
+        level++;
+    return level;
+}
+
+static void release_input(pipeline *pipe, const pipeline_frame &bgra) {
+    if (bgra.held)
+        pipe->release(pipe->release_data, bgra.held);
+    else
+        frame_pool_release(&pipe->capture_pool, bgra.data);
+}
+
+// While draining a level frame is waited for, up to the drain deadline, instead of dropped.
+static uint8_t *acquire_level(pipeline *pipe, size_t level, bool draining, uint64_t deadline) {
+    return draining ? frame_pool_acquire_until(pipe->levels[level], deadline)
+                    : frame_pool_acquire(pipe->levels[level]);
+}
+
+static void process_frame(pipeline *pipe, const pipeline_frame &bgra, bool draining,
+                          uint64_t deadline) {
+    std::vector<uint8_t *> frames(pipe->levels.size(), nullptr);
+
+    frames[0] = acquire_level(pipe, 0, draining, deadline);
+    if (frames[0]) {
+        const i420_planes planes = frame_pool_i420(pipe->levels[0], frames[0]);
+        bgra_to_i420(bgra.data, bgra.stride, &planes);
+    }
+    release_input(pipe, bgra);
+
+    activity_sample activity;
+    const bool measured = pipe->activity && frames[0];
+    if (measured) {
+        const i420_planes planes = frame_pool_i420(pipe->levels[0], frames[0]);
+        activity = activity_measure(pipe->activity, &planes);
+    }
+
+    for (size_t level = 1; level < pipe->levels.size() && frames[level - 1]; level++) {
+        frames[level] = acquire_level(pipe, level, draining, deadline);
+        if (!frames[level])
+            break;
+        const i420_planes src = frame_pool_i420(pipe->levels[level - 1], frames[level - 1]);
+        const i420_planes dst = frame_pool_i420(pipe->levels[level], frames[level]);
+        i420_downscale_2x(&src, &dst);
+    }
+
+    for (size_t i = 0; i < pipe->outputs.size(); i++) {
+        uint8_t *frame = frames[pipe->output_level[i]];
+        if (frame)
+            encoder_submit(pipe->outputs[i], frame, bgra.pts_ns, measured ? &activity : nullptr);
+        else
+            pipe->outputs[i]->dropped++;
+    }
+
+    for (size_t level = 0; level < frames.size(); level++) {
+        if (frames[level])
+            frame_pool_release(pipe->levels[level], frames[level]);
+    }
+}
+
+static void worker_loop(pipeline *pipe) {
+    if (pipe->process_policy)
+        sched_apply(SR_ROLE_PROCESS, pipe->process_policy, 0, 0, &pipe->stats->placements);
+
+    for (;;) {
+        pipeline_frame frame;
+        bool draining;
+        uint64_t deadline;
+        {
+            std::unique_lock guard(pipe->lock);
+            pipe->cv.wait(guard, [pipe] { return pipe->stopping || !pipe->queue.empty(); });
+            if (pipe->queue.empty())
+                break;
+            frame = pipe->queue.front();
+            pipe->queue.pop_front();
+            draining = pipe->stopping;
+            deadline = pipe->stop_deadline_ns;
+        }
+        if (deadline && now_ns() > deadline) {
+            release_input(pipe, frame);
+            pipe->stats->dropped++;
+            continue;
+        }
+        process_frame(pipe, frame, draining, deadline);
+    }
+    sched_forget(&pipe->stats->placements, 0);
+}
+
+// Undoes a pipeline_init that failed partway: finalises the encoders that did start and
+// frees every pool.
+static bool abandon(pipeline *pipe) {
+    for (encoder *enc : pipe->outputs)
+        encoder_stop(enc, 0, 0);
+    pipeline_destroy(pipe);
+    return false;
+}
+
+bool pipeline_init(pipeline *pipe, uint32_t width, uint32_t height,
+                   const std::vector<output_profile> &profiles, uint32_t pool_frames,
+                   const thread_policy *policies, sr_stats *stats) {
+    pipe->stats = stats;
+    pipe->process_policy = &policies[SR_ROLE_PROCESS];
+
+    if (!frame_pool_init(&pipe->capture_pool, FRAME_FORMAT_BGRA, width, height, pool_frames))
+        return abandon(pipe);
+
+    uint32_t depth = 1;
+    for (const output_profile &profile : profiles) {
+        pipe->output_level.push_back(pipeline_level(width, height, profile));
+        depth = std::max(depth, pipe->output_level.back() + 1);
+        if (profile.adaptive && !pipe->activity)
+            pipe->activity = new activity_meter{};
+    }
+
+    for (uint32_t level = 0; level < depth; level++) {
+        // Every output gets its own share of its level, on top of the frames the pipeline
+        // itself is converting, so one falling behind never starves the others.
+        uint32_t count = pool_frames;
+        for (size_t i = 0; i < profiles.size(); i++) {
+            if (pipe->output_level[i] == level)
+                count += output_profile_backlog(&profiles[i], pool_frames);
+        }
+
+        auto *pool = new frame_pool{};
+        const uint32_t w = level ? level_size(width, level) : width;
+        const uint32_t h = level ? level_size(height, level) : height;
+        if (!frame_pool_init(pool, FRAME_FORMAT_I420, w, h, count)) {
+            delete pool;
+            return abandon(pipe);
+        }
+        pipe->levels.push_back(pool);
+    }
+
+    for (size_t i = 0; i < profiles.size(); i++) {
+        auto *enc = new encoder{};
+        enc->writer_policy = &policies[SR_ROLE_WRITER];
+        enc->process_policy = &policies[SR_ROLE_ENCODER];
+        enc->placements = &stats->placements;
+        if (!encoder_start(enc, &profiles[i], pipe->levels[pipe->output_level[i]],
+                           output_profile_backlog(&profiles[i], pool_frames))) {
+            encoder_destroy(enc);
+            delete enc;
+            return abandon(pipe);
+        }
+        pipe->outputs.push_back(enc);
+    }
+
+    pipe->stopping = false;
+    pipe->worker = std::thread(worker_loop, pipe);
+    return true;
+}
+
+uint8_t *pipeline_acquire(pipeline *pipe) { return frame_pool_acquire(&pipe->capture_pool); }
+
+void pipeline_submit(pipeline *pipe, uint8_t *data, uint32_t stride, uint64_t pts_ns,
+                     void *held) {
+    {
+        std::lock_guard guard(pipe->lock);
+        pipe->queue.push_back({data, stride, pts_ns, held});
+    }
+    pipe->cv.notify_one();
+}
+
+uint32_t pipeline_unhold(pipeline *pipe, void *held) {
+    const uint32_t row_bytes = pipe->capture_pool.width * 4;
+    uint32_t given_up = 0;
+    std::lock_guard guard(pipe->lock);
+    for (auto it = pipe->queue.begin(); it != pipe->queue.end();) {
+        if (it->held != held) {
+            ++it;
+            continue;
+        }
+        given_up++;
+        uint8_t *copy = frame_pool_acquire(&pipe->capture_pool);
+        if (!copy) {
+            pipe->stats->dropped++;
+            it = pipe->queue.erase(it);
+            continue;
+        }
+        for (uint32_t y = 0; y < pipe->capture_pool.height; y++)
+            memcpy(copy + static_cast<size_t>(y) * pipe->capture_pool.stride,
+                   it->data + static_cast<size_t>(y) * it->stride, row_bytes);
+        *it = {copy, pipe->capture_pool.stride, it->pts_ns, nullptr};
+        ++it;
+    }
+    return given_up;
+}
+
+void pipeline_stop(pipeline *pipe, uint64_t deadline_ns) {
+    // Every wait below is bounded by deadline_ns: queued frames are converted and written
+    // until the drain deadline, what is left of it finalises the files.
+    uint64_t drain_deadline_ns = 0;
+    if (deadline_ns) {
+        const uint64_t now = now_ns();
+        const uint64_t left = deadline_ns > now ? deadline_ns - now : 0;
+        drain_deadline_ns = deadline_ns - std::min<uint64_t>(left / 2, STOP_RESERVE_NS);
+    }
+
+    for (encoder *enc : pipe->outputs)
+        encoder_block(enc, drain_deadline_ns);
+    {
+        std::lock_guard guard(pipe->lock);
+        pipe->stopping = true;
+        pipe->stop_deadline_ns = drain_deadline_ns;
+    }
+    pipe->cv.notify_one();
+    if (pipe->worker.joinable())
+        pipe->worker.join();
+
+    for (encoder *enc : pipe->outputs)
+        encoder_stop(enc, drain_deadline_ns, deadline_ns);
+}
+
+void pipeline_totals(const pipeline *pipe, uint64_t *encoded, uint64_t *dropped) {
+    *encoded = 0;
+    *dropped = 0;
+    for (const encoder *enc : pipe->outputs) {
+        *encoded += enc->encoded;
+        *dropped += enc->dropped;
+    }
+}
+
+void pipeline_report(const pipeline *pipe) {
+    for (const encoder *enc : pipe->outputs)
+        sr_log("[stats] %s: encoded %lu, dropped %lu\n", enc->profile.file.c_str(),
+               (unsigned long) enc->encoded.load(), (unsigned long) enc->dropped.load());
+}
+
+void pipeline_destroy(pipeline *pipe) {
+    for (encoder *enc : pipe->outputs) {
+        encoder_destroy(enc);
+        delete enc;
+    }
+    pipe->outputs.clear();
+    for (frame_pool *pool : pipe->levels) {
+        frame_pool_destroy(pool);
+        delete pool;
+    }
+    pipe->levels.clear();
+    frame_pool_destroy(&pipe->capture_pool);
+    delete pipe->activity;
+    pipe->activity = nullptr;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "activity.h"
+#include "encoder.h"
+#include "frame-pool.h"
+#include "stats.h"
+#include "thread-policy.h"
+
+// One capture, several outputs. Captured BGRA frames are converted to I420 once, halved into
+// a pyramid as deep as the smallest output needs, and every output is fed the level closest
+// to (but not below) its own resolution. Each output encodes on its own writer thread.
+
+struct pipeline_frame {
+    uint8_t *data;
+    uint32_t stride;
+    uint64_t pts_ns;
+    void *held; // borrowed capture buffer, or nullptr for a capture_pool copy
+};
+
+struct pipeline {
+    frame_pool capture_pool; // BGRA copies of the PipeWire buffers
+    std::vector<frame_pool *> levels;
+    std::vector<encoder *> outputs;
+    std::vector<uint32_t> output_level;
+    activity_meter *activity = nullptr; // only when an output is adaptive
+
+    sr_stats *stats = nullptr;
+    const thread_policy *process_policy = nullptr;
+
+    std::thread worker;
+    std::mutex lock;
+    std::condition_variable cv;
+    std::deque<pipeline_frame> queue;
+    bool stopping = false;
+    uint64_t stop_deadline_ns = 0;
+
+    // Hands a borrowed capture buffer back once the pipeline stopped reading it.
+    void (*release)(void *data, void *held) = nullptr;
+    void *release_data = nullptr;
+};
+
+// Pyramid level an output is fed from: the deepest one still at least as large as the
+// profile's size, 0 for the capture size.
+uint32_t pipeline_level(uint32_t width, uint32_t height, const output_profile &profile);
+
+// On failure everything allocated so far is released again.
+bool pipeline_init(pipeline *pipe, uint32_t width, uint32_t height,
+                   const std::vector<output_profile> &profiles, uint32_t pool_frames,
+                   const thread_policy *policies, sr_stats *stats);
+
+// BGRA buffer to copy a captured frame into, or nullptr when the pipeline is saturated.
+uint8_t *pipeline_acquire(pipeline *pipe);
+// Queues a BGRA frame. With held set, data belongs to the capture and stays valid until
+// release(release_data, held) is called; otherwise it is a pipeline_acquire buffer.
+void pipeline_submit(pipeline *pipe, uint8_t *data, uint32_t stride, uint64_t pts_ns,
+                     void *held);
+// Moves every queued frame still reading held to a capture_pool copy, or drops it when the
+// pool is exhausted, so the capture buffer can go away. Returns how many holds on held were
+// given up that way; release is not called for them.
+uint32_t pipeline_unhold(pipeline *pipe, void *held);
+
+// Converts and encodes every queued frame, waiting for pool frames and queue space rather
+// than dropping, then finalises all outputs. The whole stop, ffmpeg's finalising and the
+// joining of segments included, is over by deadline_ns (CLOCK_MONOTONIC, 0 for no limit);
+// frames still queued when draining has to give way to that are dropped.
+void pipeline_stop(pipeline *pipe, uint64_t deadline_ns);
+// Frames encoded and dropped by all outputs together, and a [stats] line per output.
+void pipeline_totals(const pipeline *pipe, uint64_t *encoded, uint64_t *dropped);
+void pipeline_report(const pipeline *pipe);
+
+// Frees the pools and encoders of a stopped pipeline.
+void pipeline_destroy(pipeline *pipe);
@@ -1,6 +1,14 @@
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
 #include <cmath>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <fcntl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 #include <pipewire/pipewire.h>
 #include <spa/param/video/format-utils.h>
@@ -8,144 +16,427 @@
 #include <spa/debug/format.h>
 #include <spa/utils/result.h>
 
+#include "calibrate.h"
+#include "pipeline.h"
 #include "pipewire.h"
-#include "utils.h"
+#include "log.h"
 
+// Older PipeWire only knows the deprecated name.
+#ifndef PW_KEY_TARGET_OBJECT
+#define PW_KEY_TARGET_OBJECT PW_KEY_NODE_TARGET
+#endif
 
-static FILE *ffmpeg_pipe = nullptr;
-
-
-uint64_t now_ns() {
-    timespec ts;
-    clock_gettime(CLOCK_MONOTONIC, &ts);
-    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+static void copy_frame(uint8_t *dst, uint32_t dst_stride, const uint8_t *src, uint32_t src_stride,
+                       uint32_t row_bytes, uint32_t height) {
+    if (dst_stride == src_stride) {
+        memcpy(dst, src, static_cast<size_t>(src_stride) * height);
+        return;
+    }
+    for (uint32_t y = 0; y < height; y++)
+        memcpy(dst + static_cast<size_t>(y) * dst_stride, src + static_cast<size_t>(y) * src_stride,
+               row_bytes);
 }
 
-void start_ffmpeg_pipe() {
-    char cmd[1024];
-    snprintf(cmd, sizeof(cmd),
-             "ffmpeg -y -loglevel error -stats "
-             "-f rawvideo "
-             "-pix_fmt bgra "
-             "-s %dx%d "
-             "-r %d "
-             "-i - "
-             "-c:v libx264 "
-             "-preset ultrafast "
-             "-tune zerolatency "
-             "-crf 30 "
-             "-pix_fmt yuv420p "
-             "-vf scale=%d:%d:flags=fast_bilinear "
-             "-movflags +faststart+frag_keyframe+empty_moov "
-             "%s",
-             WindowMonitor::width, WindowMonitor::height, SROptions::outputFps,
-             SROptions::outputWidth, SROptions::outputHeight, SROptions::outputFile.c_str());
+// How long on_remove_buffer waits for the pipeline or the application to let go of a buffer
+// before PipeWire unmaps it.
+#define HOLD_RELEASE_TIMEOUT_MS 1000
 
-    ffmpeg_pipe = popen(cmd, "w");
+// A dequeued buffer may be read by the pipeline and the application at once; it goes back
+// to PipeWire when the last of them lets go. This, not the pw_buffer, is the handle they
+// keep, so it can outlive a buffer removed while still held. Called with the loop lock held.
+struct held_buffer {
+    pw_buffer *buffer; // nullptr once PipeWire removed it
+    uint32_t refs;
+};
+
+static held_buffer *hold_buffer(pw_capture *cap, pw_buffer *b) {
+    auto *held = static_cast<held_buffer *>(b->user_data);
+    if (held->refs++ == 0)
+        cap->held++;
+    return held;
 }
 
-void close_ffmpeg_pipe() {
-    if (ffmpeg_pipe) {
-        pclose(ffmpeg_pipe);
-        ffmpeg_pipe = nullptr;
+static void unhold_buffer(pw_capture *cap, held_buffer *held) {
+    if (--held->refs != 0)
+        return;
+    if (!held->buffer) {
+        delete held;
+        return;
     }
+    cap->held--;
+    if (cap->stream)
+        pw_stream_queue_buffer(cap->stream, held->buffer);
+    // on_remove_buffer may be waiting for this one.
+    if (cap->loop)
+        pw_thread_loop_signal(cap->loop, false);
 }
 
-void handle_sigint(int signo) {
-    close_ffmpeg_pipe();
-    exit(0);
-}
+static bool is_held(const pw_buffer *b) { return static_cast<held_buffer *>(b->user_data)->refs; }
 
+// Keeps the frame as the newest one for pw_capture_acquire, replacing one nobody took.
+static void offer_latest(pw_capture *cap, pw_buffer *b, const recorder_frame &frame) {
+    held_buffer *replaced = nullptr;
+    {
+        std::lock_guard guard(cap->latest_lock);
+        if (cap->has_latest)
+            replaced = static_cast<held_buffer *>(cap->latest.buffer);
+        else if (cap->held >= cap->hold_limit)
+            return;
+        cap->latest = frame;
+        cap->latest.buffer = hold_buffer(cap, b);
+        cap->has_latest = true;
+    }
+    cap->latest_cv.notify_one();
+    if (replaced)
+        unhold_buffer(cap, replaced);
+}
 
 static void on_process(void *data) {
     auto *cap = static_cast<pw_capture *>(data);
-
-    static uint64_t last_write_ns = 0;
-    static uint64_t frame_count = 0;
-    frame_count++;
+    const recorder_config *config = cap->config;
 
     pw_buffer *b = pw_stream_dequeue_buffer(cap->stream);
     if (!b)
         return;
 
     const spa_buffer *buf = b->buffer;
-    if (!buf || buf->datas[0].chunk->size == 0) {
+    if (!buf || buf->datas[0].chunk->size == 0 || !cap->format_known ||
+        cap->stream_width != cap->width || cap->stream_height != cap->height) {
+        pw_stream_queue_buffer(cap->stream, b);
+        return;
+    }
+
+    const uint32_t row_bytes = cap->width * 4;
+    const spa_data &d = buf->datas[0];
+    const uint32_t src_stride = d.chunk->stride > 0 ? d.chunk->stride : row_bytes;
+    // Every reader below takes height rows of src_stride bytes; a buffer that does not hold
+    // them is skipped rather than read past its end.
+    const uint64_t needed = static_cast<uint64_t>(src_stride) * (cap->height - 1) + row_bytes;
+    if (src_stride < row_bytes || d.chunk->size < needed ||
+        d.chunk->offset + needed > d.maxsize) {
         pw_stream_queue_buffer(cap->stream, b);
         return;
     }
+    auto *src = static_cast<uint8_t *>(d.data) + d.chunk->offset;
+
+    cap->stats->captured++;
+    cap->sequence++;
+    uint64_t t = now_ns();
 
-    if (!ffmpeg_pipe)
-        start_ffmpeg_pipe();
+    if (cap->bus)
+        frame_bus_publish(cap->bus, src, src_stride, t);
+
+    const recorder_frame frame{src, cap->width,    cap->height, src_stride,
+                               t,   cap->sequence, b->user_data};
+    if (config->on_frame)
+        config->on_frame(frame);
+    if (config->pull_frames)
+        offer_latest(cap, b, frame);
 
     bool should_write = false;
 
     // 根据目标 fps 丢帧
-    uint64_t t = now_ns();
-    if (t - last_write_ns >= 1000000000ull * SROptions::inputFpsNum / SROptions::inputFpsDen) {
-        last_write_ns = t;
+    if (cap->pipe &&
+        t - cap->last_write_ns >= 1000000000ull * config->input_fps_den / config->input_fps_num) {
+        cap->last_write_ns = t;
         should_write = true;
     }
 
-    if (should_write && ffmpeg_pipe) {
-        fwrite(buf->datas[0].data, 1, WindowMonitor::width * WindowMonitor::height * 4,
-               ffmpeg_pipe);
+    // Hold the PipeWire buffer while the pipeline reads it, as long as enough buffers stay
+    // with the producer. It is queued back by release_buffer once converted.
+    if (should_write && (is_held(b) || cap->held < cap->hold_limit)) {
+        held_buffer *held = hold_buffer(cap, b);
+        cap->stats->zero_copy++;
+        pipeline_submit(cap->pipe, src, src_stride, t, held);
+    } else if (should_write) {
+        uint8_t *copy = pipeline_acquire(cap->pipe);
+        if (copy) {
+            copy_frame(copy, cap->pipe->capture_pool.stride, src, src_stride, row_bytes,
+                       cap->height);
+            cap->stats->copied++;
+            pipeline_submit(cap->pipe, copy, cap->pipe->capture_pool.stride, t, nullptr);
+        } else {
+            // Pipeline is behind and every pool frame is queued; never block the loop on it.
+            cap->stats->dropped++;
+        }
     }
 
-    pw_stream_queue_buffer(cap->stream, b);
+    if (!is_held(b))
+        pw_stream_queue_buffer(cap->stream, b);
+    if (stats_report(cap->stats, t) && cap->pipe)
+        pipeline_report(cap->pipe);
 }
 
-void on_param(void *data, uint32_t id, const struct spa_pod *param) {
-    static bool sizeGot = false;
-    if (not sizeGot) {
-        pw_capture *cap = static_cast<pw_capture *>(data);
+// Called from the pipeline thread once it no longer reads a held buffer.
+static void release_buffer(void *data, void *held) {
+    auto *cap = static_cast<pw_capture *>(data);
+    pw_thread_loop_lock(cap->loop);
+    unhold_buffer(cap, static_cast<held_buffer *>(held));
+    pw_thread_loop_unlock(cap->loop);
+}
 
-        if (param == nullptr)
-            return;
+static void update_hold_limit(pw_capture *cap) {
+    // Two buffers always stay with the producer so it never stalls on us.
+    cap->hold_limit = cap->buffers > 2 ? cap->buffers - 2 : 0;
+}
 
-        spa_video_info_raw info;
-        if (spa_format_video_raw_parse(param, &info) >= 0) {
-            sizeGot = true;
-            WindowMonitor::width = info.size.width;
-            WindowMonitor::height = info.size.height;
-            if (SROptions::outputHeight == 0) {
-                SROptions::outputHeight = WindowMonitor::height;
-                SROptions::outputWidth = WindowMonitor::width;
+static void on_add_buffer(void *data, pw_buffer *buffer) {
+    auto *cap = static_cast<pw_capture *>(data);
+    buffer->user_data = new held_buffer{buffer, 0};
+    cap->buffers++;
+    update_hold_limit(cap);
+}
+
+// Gives up holds without queueing the buffer again, for one that is being removed.
+static void drop_holds(pw_capture *cap, held_buffer *held, uint32_t count) {
+    held->refs -= count;
+    if (count && held->refs == 0)
+        cap->held--;
+}
+
+// The buffer's memory goes away after this returns. A frame nobody took yet is let go and
+// queued pipeline frames move to copies; whoever still reads it gets a moment to finish.
+// Waiting releases the loop lock that release_buffer needs.
+static void on_remove_buffer(void *data, pw_buffer *buffer) {
+    auto *cap = static_cast<pw_capture *>(data);
+    auto *held = static_cast<held_buffer *>(buffer->user_data);
+    if (held->refs) {
+        bool was_latest = false;
+        {
+            std::lock_guard guard(cap->latest_lock);
+            if (cap->has_latest && cap->latest.buffer == held) {
+                cap->has_latest = false;
+                was_latest = true;
             }
-            printf("[pipewire] Got actual width=%d height=%d\n", WindowMonitor::width,
-                   WindowMonitor::height);
         }
+        drop_holds(cap, held, was_latest ? 1 : 0);
+    }
+    if (held->refs && cap->pipe)
+        drop_holds(cap, held, pipeline_unhold(cap->pipe, held));
+    if (held->refs) {
+        timespec deadline;
+        pw_thread_loop_get_time(cap->loop, &deadline, HOLD_RELEASE_TIMEOUT_MS * 1000000ll);
+        while (held->refs && pw_thread_loop_timed_wait_full(cap->loop, &deadline) == 0) {
+        }
+    }
+    const bool still_read = held->refs != 0;
+    if (still_read) {
+        // Still read after all: the last unhold_buffer frees the handle, the buffer is not
+        // queued again, and what reads it can no longer be trusted.
+        held->buffer = nullptr;
+        cap->held--;
+    } else {
+        delete held;
+    }
+    buffer->user_data = nullptr;
+    cap->buffers--;
+    update_hold_limit(cap);
+    if (still_read)
+        pw_capture_fail(cap, "a buffer was removed while a frame in it was still read");
+}
+
+static void request_buffers(pw_capture *cap) {
+    spa_pod_builder b;
+    uint8_t buffer[256];
+    spa_pod_builder_init(&b, buffer, sizeof(buffer));
+
+    const int count = static_cast<int>(cap->config->pw_buffers);
+    const spa_pod *params[1];
+    params[0] = static_cast<spa_pod *>(spa_pod_builder_add_object(
+            &b, SPA_TYPE_OBJECT_ParamBuffers, SPA_PARAM_Buffers, SPA_PARAM_BUFFERS_buffers,
+            SPA_POD_CHOICE_RANGE_Int(count, 2, std::max(count, 16)), SPA_PARAM_BUFFERS_dataType,
+            SPA_POD_CHOICE_FLAGS_Int((1 << SPA_DATA_MemPtr) | (1 << SPA_DATA_MemFd))));
+    pw_stream_update_params(cap->stream, params, 1);
+}
+
+static pipeline *start_pipeline(pw_capture *cap, const std::vector<output_profile> &outputs) {
+    const recorder_config *config = cap->config;
+    auto *pipe = new pipeline{};
+    if (!pipeline_init(pipe, cap->width, cap->height, outputs, config->pool_frames,
+                       config->thread_policies, cap->stats)) {
+        delete pipe;
+        return nullptr;
     }
+    pipe->release = release_buffer;
+    pipe->release_data = cap;
+    return pipe;
 }
 
+// Runs off the loop thread, since measuring takes seconds; frames captured meanwhile are
+// only offered to the application.
+static void calibrate_and_start(pw_capture *cap) {
+    const recorder_config *config = cap->config;
+    std::vector<output_profile> outputs = config->outputs;
+    output_profile *primary = &outputs[0];
+
+    calibration_result result;
+    calibration_status status = CALIBRATION_OK;
+    if (!config->recalibrate && calibration_load(cap->width, cap->height, primary, &result)) {
+        sr_log("[calibrate] using the cached result for %ux%u at %u fps\n", cap->width,
+               cap->height, primary->fps);
+    } else {
+        sr_log("[calibrate] measuring %ux%u at %u fps, this takes a few seconds\n", cap->width,
+               cap->height, primary->fps);
+        status = calibrate(cap->width, cap->height, primary, config->thread_policies,
+                           &cap->cancel_calibration, &result);
+        // Stopping: no pipeline to start, and nothing worth caching.
+        if (cap->cancel_calibration)
+            return;
+        if (status == CALIBRATION_FALLBACK)
+            sr_log("[calibrate] nothing keeps up with %u fps, using the fastest setup\n",
+                   primary->fps);
+        if (status != CALIBRATION_FAILED)
+            calibration_save(cap->width, cap->height, primary, &result);
+    }
+    if (status == CALIBRATION_FAILED) {
+        sr_log("[calibrate] %s: calibration failed, keeping the configured settings\n",
+               primary->file.c_str());
+    } else {
+        calibration_apply(&result, primary);
+        sr_log("[calibrate] %s: preset %s, %u workers, %ux%u (conversion %.0f fps, scaling "
+               "%.0f fps, encoder %.0f fps)\n",
+               primary->file.c_str(), primary->preset.c_str(), primary->workers,
+               primary->width ? primary->width : cap->width,
+               primary->height ? primary->height : cap->height, result.convert_fps,
+               result.scale_fps, result.encode_fps);
+    }
+
+    pipeline *pipe = start_pipeline(cap, outputs);
+    pw_thread_loop_lock(cap->loop);
+    cap->pipe = pipe;
+    pw_thread_loop_unlock(cap->loop);
+    if (!pipe)
+        pw_capture_fail(cap, "cannot start the encode pipeline");
+}
+
+void on_param(void *data, uint32_t id, const struct spa_pod *param) {
+    pw_capture *cap = static_cast<pw_capture *>(data);
+    if (param == nullptr)
+        return;
+
+    spa_video_info_raw info;
+    if (spa_format_video_raw_parse(param, &info) < 0)
+        return;
+
+    cap->stream_width = info.size.width;
+    cap->stream_height = info.size.height;
+    if (cap->format_known) {
+        // A window being resized renegotiates. Everything downstream is sized for the first
+        // format, so frames of any other size are skipped until the source is back to it.
+        if (cap->stream_width != cap->width || cap->stream_height != cap->height)
+            sr_log("[pipewire] source is now %ux%u, frames are skipped until it is %ux%u "
+                   "again\n",
+                   cap->stream_width, cap->stream_height, cap->width, cap->height);
+        request_buffers(cap);
+        return;
+    }
+
+    cap->format_known = true;
+    cap->width = info.size.width;
+    cap->height = info.size.height;
+    sr_log("[pipewire] Got actual width=%d height=%d\n", cap->width, cap->height);
+
+    // The geometry is fixed for the session, so every buffer is allocated and every encoder
+    // started up front, here rather than on the first frame. Without outputs frames only go to
+    // the application.
+    const recorder_config *config = cap->config;
+    if (!config->frame_bus_path.empty()) {
+        cap->bus = new frame_bus{};
+        if (!frame_bus_create(cap->bus, config->frame_bus_path.c_str(), cap->width, cap->height,
+                              cap->width * 4, SPA_VIDEO_FORMAT_BGRA, 0)) {
+            delete cap->bus;
+            cap->bus = nullptr;
+        }
+    }
+    if (!config->outputs.empty() && config->calibrate)
+        cap->calibration = std::thread(calibrate_and_start, cap);
+    else if (!config->outputs.empty() && !(cap->pipe = start_pipeline(cap, config->outputs)))
+        pw_capture_fail(cap, "cannot start the encode pipeline");
+
+    request_buffers(cap);
+}
+
+static void on_state_changed(void *data, pw_stream_state old, pw_stream_state state,
+                             const char *error) {
+    auto *cap = static_cast<pw_capture *>(data);
+    sr_log("[pipewire] stream %s%s%s\n", pw_stream_state_as_string(state), error ? ": " : "",
+           error ? error : "");
+    if (state == PW_STREAM_STATE_ERROR)
+        pw_capture_fail(cap, error ? error : "stream error");
+    else if (state == PW_STREAM_STATE_UNCONNECTED && !cap->closing)
+        pw_capture_fail(cap, "stream disconnected");
+}
 
 static constexpr pw_stream_events stream_events = {
         PW_VERSION_STREAM_EVENTS,
+        .state_changed = on_state_changed,
         .param_changed = on_param,
+        .add_buffer = on_add_buffer,
+        .remove_buffer = on_remove_buffer,
         .process = on_process,
 };
 
-void pw_capture_start(pw_capture *cap) {
-    printf("[pipewire] start capturing\n");
+static int get_thread_id(spa_loop *, bool, uint32_t, const void *, size_t, void *user_data) {
+    *static_cast<pid_t *>(user_data) = static_cast<pid_t>(syscall(SYS_gettid));
+    return 0;
+}
+
+bool pw_capture_start(pw_capture *cap) {
+    sr_log("[pipewire] start capturing\n");
     pw_init(nullptr, nullptr);
 
     cap->loop = pw_thread_loop_new("pw-loop", NULL);
     pw_thread_loop_start(cap->loop);
 
+    // Place the loop thread from here: an rtkit request is a blocking D-Bus call, which must
+    // not run on the thread that processes frames.
+    pid_t loop_tid = 0;
+    pw_loop_invoke(pw_thread_loop_get_loop(cap->loop), get_thread_id, 0, nullptr, 0, true,
+                   &loop_tid);
+    if (loop_tid)
+        sched_apply(SR_ROLE_CAPTURE, &cap->config->thread_policies[SR_ROLE_CAPTURE], 0,
+                    loop_tid, &cap->stats->placements);
+
     pw_thread_loop_lock(cap->loop);
 
     cap->context = pw_context_new(pw_thread_loop_get_loop(cap->loop), nullptr, 0);
 
-    cap->core = pw_context_connect_fd(cap->context, fcntl(cap->pipewire_fd, F_DUPFD_CLOEXEC, 3),
-                                      nullptr, 0);
+    if (cap->pipewire_fd >= 0) {
+        cap->core = pw_context_connect_fd(
+                cap->context, fcntl(cap->pipewire_fd, F_DUPFD_CLOEXEC, 3), nullptr, 0);
+    } else {
+        // No portal: talk to the session's daemon, or the one behind --pipewire-remote.
+        pw_properties *core_props = pw_properties_new(nullptr, nullptr);
+        if (!cap->remote.empty())
+            pw_properties_set(core_props, PW_KEY_REMOTE_NAME, cap->remote.c_str());
+        cap->core = pw_context_connect(cap->context, core_props, 0);
+    }
 
     if (!cap->core) {
-        fprintf(stderr, "pw_context_connect_fd failed\n");
+        sr_log("[pipewire] cannot connect to %s: %s\n",
+               cap->pipewire_fd >= 0 ? "portal remote"
+               : cap->remote.empty() ? "default daemon"
+                                     : cap->remote.c_str(),
+               strerror(errno));
         pw_thread_loop_unlock(cap->loop);
-        return;
+        return false;
     }
 
     pw_properties *props = pw_properties_new(PW_KEY_MEDIA_TYPE, "Video", PW_KEY_MEDIA_CATEGORY,
                                              "Capture", PW_KEY_MEDIA_ROLE, "Screen", NULL);
+    // A number is a node id, as the portal hands out, and goes to pw_stream_connect:
+    // PW_KEY_TARGET_OBJECT only takes a node.name or an object.serial.
+    uint32_t target_id = PW_ID_ANY;
+    if (!cap->target.empty()) {
+        char *end;
+        const unsigned long id = strtoul(cap->target.c_str(), &end, 10);
+        if (*end == '\0' && isdigit(static_cast<unsigned char>(cap->target[0])))
+            target_id = static_cast<uint32_t>(id);
+        else
+            pw_properties_set(props, PW_KEY_TARGET_OBJECT, cap->target.c_str());
+        // A missing target is an error, not a reason to record some other source.
+        pw_properties_set(props, "node.dont-fallback", "true");
+    }
 
     cap->stream = pw_stream_new(cap->core, "screen-capture", props);
 
@@ -157,11 +448,12 @@ void pw_capture_start(pw_capture *cap) {
     const spa_pod *params[1];
 
     spa_pod_builder_init(&b, buffer, sizeof(buffer));
-    auto framerate = SPA_FRACTION(SROptions::inputFpsNum, SROptions::inputFpsDen);
-    printf("[pipewire] targeting fps num: %d ,fps denom: %d\n", SROptions::inputFpsNum,
-           SROptions::inputFpsDen);
+    const recorder_config *config = cap->config;
+    auto framerate = SPA_FRACTION(config->input_fps_num, config->input_fps_den);
+    sr_log("[pipewire] targeting fps num: %d ,fps denom: %d\n", config->input_fps_num,
+           config->input_fps_den);
     constexpr auto min_framerate = SPA_FRACTION(0, 1);
-    uint maxRate = SROptions::inputFpsNum / SROptions::inputFpsDen + 1;
+    uint maxRate = config->input_fps_num / config->input_fps_den + 1;
     auto max_framerate = SPA_FRACTION(maxRate, 1);
     auto resolution = SPA_RECTANGLE(1920, 1180);
     auto min_resolution = SPA_RECTANGLE(1, 1);
@@ -177,13 +469,160 @@ void pw_capture_start(pw_capture *cap) {
             SPA_FORMAT_VIDEO_framerate,
             SPA_POD_CHOICE_RANGE_Fraction(&framerate, &min_framerate, &max_framerate)));
 
-    pw_stream_connect(
-            cap->stream, PW_DIRECTION_INPUT, cap->node_id,
-            static_cast<pw_stream_flags>(PW_STREAM_FLAG_AUTOCONNECT | PW_STREAM_FLAG_MAP_BUFFERS),
+    const int res = pw_stream_connect(
+            cap->stream, PW_DIRECTION_INPUT, target_id,
+            static_cast<pw_stream_flags>(PW_STREAM_FLAG_AUTOCONNECT | PW_STREAM_FLAG_MAP_BUFFERS |
+                                         PW_STREAM_FLAG_DONT_RECONNECT),
             params, 1);
-
+    if (res < 0) {
+        sr_log("[pipewire] cannot connect the stream: %s\n", strerror(-res));
+        pw_thread_loop_unlock(cap->loop);
+        return false;
+    }
 
     pw_stream_set_active(cap->stream, true);
 
     pw_thread_loop_unlock(cap->loop);
+    cap->started = true;
+    return true;
+}
+
+void pw_capture_fail(pw_capture *cap, const char *reason) {
+    if (cap->failed.exchange(true))
+        return;
+    sr_log("[SR] capture failed: %s\n", reason);
+    if (cap->config->on_error)
+        cap->config->on_error(reason);
+}
+
+void pw_capture_stop(pw_capture *cap, uint32_t timeout_ms) {
+    const uint64_t start = now_ns();
+    const uint64_t dropped = cap->stats ? cap->stats->dropped.load() : 0;
+
+    // No new frames from here on; anything already captured is still encoded.
+    if (cap->stream) {
+        pw_thread_loop_lock(cap->loop);
+        cap->closing = true;
+        pw_stream_set_active(cap->stream, false);
+        pw_thread_loop_unlock(cap->loop);
+    }
+
+    if (cap->calibration.joinable()) {
+        cap->cancel_calibration = true;
+        cap->calibration.join();
+    }
+
+    // Not under the loop lock: the pipeline hands held buffers back through release_buffer.
+    uint64_t encoded = 0, output_dropped = 0, encoded_after = 0, dropped_after = 0;
+    if (cap->pipe) {
+        pipeline_totals(cap->pipe, &encoded, &output_dropped);
+        pipeline_stop(cap->pipe, timeout_ms ? start + timeout_ms * 1000000ull : 0);
+        pipeline_totals(cap->pipe, &encoded_after, &dropped_after);
+    }
+
+    // Wake pw_capture_acquire callers and return the frame nobody took.
+    held_buffer *latest = nullptr;
+    {
+        std::lock_guard guard(cap->latest_lock);
+        if (cap->has_latest)
+            latest = static_cast<held_buffer *>(cap->latest.buffer);
+        cap->has_latest = false;
+        cap->stopped = true;
+    }
+    cap->latest_cv.notify_all();
+    if (latest && cap->loop) {
+        pw_thread_loop_lock(cap->loop);
+        unhold_buffer(cap, latest);
+        pw_thread_loop_unlock(cap->loop);
+    }
+
+    if (cap->loop) {
+        pw_thread_loop_lock(cap->loop);
+        if (cap->stream) {
+            pw_stream_disconnect(cap->stream);
+            pw_stream_destroy(cap->stream);
+            cap->stream = nullptr;
+        }
+        pw_thread_loop_unlock(cap->loop);
+        pw_thread_loop_stop(cap->loop);
+
+        if (cap->core)
+            pw_core_disconnect(cap->core);
+        if (cap->context)
+            pw_context_destroy(cap->context);
+        pw_thread_loop_destroy(cap->loop);
+        cap->core = nullptr;
+        cap->context = nullptr;
+        cap->loop = nullptr;
+    }
+
+    if (cap->bus) {
+        frame_bus_destroy(cap->bus);
+        delete cap->bus;
+        cap->bus = nullptr;
+    }
+
+    if (cap->started)
+        sr_log("[SR] stopped in %lu ms: flushed %lu frames, dropped %lu\n",
+               (unsigned long) ((now_ns() - start) / 1000000),
+               (unsigned long) (encoded_after - encoded),
+               (unsigned long) (cap->stats->dropped - dropped + dropped_after - output_dropped));
+}
+
+void pw_capture_counters(pw_capture *cap, recorder_stats *stats) {
+    stats->captured = cap->stats->captured;
+    stats->dropped = cap->stats->dropped;
+    stats->zero_copy = cap->stats->zero_copy;
+    stats->copied = cap->stats->copied;
+
+    // The pipeline appears on the loop or calibration thread, under the loop lock.
+    pipeline *pipe;
+    if (cap->loop) {
+        pw_thread_loop_lock(cap->loop);
+        pipe = cap->pipe;
+        pw_thread_loop_unlock(cap->loop);
+    } else {
+        pipe = cap->pipe;
+    }
+    stats->encoded = 0;
+    stats->output_dropped = 0;
+    if (pipe)
+        pipeline_totals(pipe, &stats->encoded, &stats->output_dropped);
+}
+
+void pw_capture_destroy(pw_capture *cap) {
+    if (cap->pipe) {
+        pipeline_destroy(cap->pipe);
+        delete cap->pipe;
+    }
+    delete cap->stats;
+    delete cap;
+}
+
+bool pw_capture_acquire(pw_capture *cap, recorder_frame *frame, int timeout_ms) {
+    std::unique_lock guard(cap->latest_lock);
+    const auto ready = [cap] { return cap->has_latest || cap->stopped; };
+    if (timeout_ms < 0)
+        cap->latest_cv.wait(guard, ready);
+    else if (!cap->latest_cv.wait_for(guard, std::chrono::milliseconds(timeout_ms), ready))
+        return false;
+    if (!cap->has_latest)
+        return false;
+
+    // The hold taken in offer_latest now belongs to the caller.
+    *frame = cap->latest;
+    cap->has_latest = false;
+    return true;
+}
+
+void pw_capture_release(pw_capture *cap, const recorder_frame *frame) {
+    auto *held = static_cast<held_buffer *>(frame->buffer);
+    // After stop the buffer is gone and only its handle is left to free.
+    if (!cap->loop) {
+        unhold_buffer(cap, held);
+        return;
+    }
+    pw_thread_loop_lock(cap->loop);
+    unhold_buffer(cap, held);
+    pw_thread_loop_unlock(cap->loop);
 }
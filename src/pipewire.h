@@ -1,12 +1,27 @@
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
 #include <pipewire/pipewire.h>
 #include <stdint.h>
-#include "pipewire.h"
+#include <string>
+#include <thread>
+#include "frame-bus.h"
+#include "pipeline.h"
+#include "recorder.h"
+#include "stats.h"
 
 struct pw_capture {
-    int pipewire_fd;
+    const recorder_config *config;
 
+    int pipewire_fd;           // portal remote, or -1 to connect to a daemon directly
+    std::string remote;        // daemon socket when connecting directly, empty for the default
+    std::string target;        // node name, or a node id as digits; empty for any node
+
+    bool started;              // pw_capture_start succeeded
+    bool closing;              // pw_capture_stop disconnects the stream, under the loop lock
+    std::atomic<bool> failed;
     pw_thread_loop *loop;
     pw_context *context;
     pw_core *core;
@@ -14,9 +29,42 @@ struct pw_capture {
     pw_stream *stream;
     spa_hook stream_listener;
 
-    uint32_t node_id;
+    bool format_known;
+    uint32_t width;
+    uint32_t height;
+    uint32_t stream_width;  // latest size negotiated, frames are only taken at width x height
+    uint32_t stream_height;
+    uint64_t last_write_ns;
+    uint64_t sequence;
+
+    uint32_t buffers;    // buffers negotiated with the producer
+    uint32_t held;       // buffers out of rotation, read by the pipeline or the application
+    uint32_t hold_limit;
+
+    // Newest frame kept for pw_capture_acquire, see recorder.h.
+    std::mutex latest_lock;
+    std::condition_variable latest_cv;
+    recorder_frame latest;
+    bool has_latest;
+    bool stopped;
+
+    frame_bus *bus;
+    std::thread calibration; // starts the pipeline once calibrated
+    std::atomic<bool> cancel_calibration;
+    pipeline *pipe;
+    sr_stats *stats; // allocated by the owner, before pw_capture_start
 };
 
-void pw_capture_start(struct pw_capture *cap);
+bool pw_capture_start(struct pw_capture *cap);
+// Reports, once, that the capture broke after start: to the log and to config->on_error.
+void pw_capture_fail(struct pw_capture *cap, const char *reason);
+// Stops capturing, drains the pipeline for at most timeout_ms (0 waits for every queued
+// frame), finalises the outputs and tears down the PipeWire connection.
+void pw_capture_stop(struct pw_capture *cap, uint32_t timeout_ms);
+// Fills the counters of a started capture, running or stopped.
+void pw_capture_counters(struct pw_capture *cap, recorder_stats *stats);
+// Frees a stopped capture, its pipeline and its counters.
+void pw_capture_destroy(struct pw_capture *cap);
 
-void handle_sigint(int signo);
+bool pw_capture_acquire(struct pw_capture *cap, recorder_frame *frame, int timeout_ms);
+void pw_capture_release(struct pw_capture *cap, const recorder_frame *frame);
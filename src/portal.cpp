@@ -1,4 +1,6 @@
 #include "portal.h"
+#include "log.h"
+#include <atomic>
 #include <cstdint>
 #include <stdio.h>
 
@@ -24,7 +26,7 @@ static void ensure_connection() {
         connection = g_bus_get_sync(G_BUS_TYPE_SESSION, nullptr, &error);
 
         if (error) {
-            printf("[portals] Error retrieving D-Bus connection: %s", error->message);
+            sr_log("[portals] Error retrieving D-Bus connection: %s", error->message);
         }
     }
 }
@@ -50,34 +52,36 @@ GDBusConnection *portal_get_dbus_connection() {
 }
 
 void portal_create_request_path(char **out_path, char **out_token) {
-    static uint32_t request_token_count = 0;
-    request_token_count++;
+    // Tokens stay unique across the captures of every Recorder in the process.
+    static std::atomic<uint32_t> request_token_count{0};
+    const uint32_t token = ++request_token_count;
 
     if (out_token) {
-        if (asprintf(out_token, "sr%u", request_token_count) < 0)
+        if (asprintf(out_token, "sr%u", token) < 0)
             *out_token = nullptr;
     }
 
     if (out_path) {
         char *sender_name = get_sender_name();
-        if (asprintf(out_path, REQUEST_PATH, sender_name, request_token_count) < 0)
+        if (asprintf(out_path, REQUEST_PATH, sender_name, token) < 0)
             *out_path = nullptr;
     }
 }
 
 
 void portal_create_session_path(char **out_path, char **out_token) {
-    static uint32_t session_token_count = 0;
-    session_token_count++;
+    // Tokens stay unique across the captures of every Recorder in the process.
+    static std::atomic<uint32_t> session_token_count{0};
+    const uint32_t token = ++session_token_count;
 
     if (out_token) {
-        if (asprintf(out_token, "sr%u", session_token_count) < 0)
+        if (asprintf(out_token, "sr%u", token) < 0)
             *out_token = nullptr;
     }
 
     if (out_path) {
         char *sender_name = get_sender_name();
-        if (asprintf(out_path, SESSION_PATH, sender_name, session_token_count) < 0)
+        if (asprintf(out_path, SESSION_PATH, sender_name, token) < 0)
             *out_path = nullptr;
     }
 }
@@ -93,7 +97,7 @@ static void portal_signal_call_free(portal_signal_call *call) {
 static void on_cancelled_cb(GCancellable *cancellable, void *data) {
     const auto call = (portal_signal_call *) data;
 
-    printf("[portals] Request cancelled");
+    sr_log("[portals] Request cancelled");
 
     g_dbus_connection_call(portal_get_dbus_connection(), "org.freedesktop.portal.Desktop",
                            call->request_path, "org.freedesktop.portal.Request", "Close", nullptr,
@@ -0,0 +1,102 @@
+#include <cstdio>
+
+#include "encoder.h"
+#include "log.h"
+#include "pipewire.h"
+#include "recorder.h"
+#include "screencast-portal.hpp"
+
+void recorder_set_log_handler(std::function<void(const char *line)> handler) {
+    sr_log_set_handler(std::move(handler));
+}
+
+Recorder::Recorder(const recorder_config &config) : config_(config) {}
+
+Recorder::~Recorder() {
+    stop();
+    if (capture_) {
+        pw_capture_destroy(capture_);
+        capture_ = nullptr;
+    }
+}
+
+bool Recorder::start() {
+    if (capture_)
+        return !stopped_;
+
+    if (config_.input_fps_num == 0 || config_.input_fps_den == 0) {
+        sr_log("[SR] invalid input frame rate %u/%u\n", config_.input_fps_num,
+               config_.input_fps_den);
+        return false;
+    }
+    for (const output_profile &profile : config_.outputs) {
+        if (profile.fps == 0) {
+            sr_log("[SR] output %s has no frame rate\n", profile.file.c_str());
+            return false;
+        }
+    }
+
+    // The encoders only start once the stream's geometry is known; a missing ffmpeg is
+    // the one failure of theirs that can be caught before that.
+    if (!config_.outputs.empty() && !encoder_available()) {
+        sr_log("[SR] ffmpeg not found in PATH\n");
+        return false;
+    }
+
+    capture_ = new pw_capture{};
+    capture_->config = &config_;
+    capture_->pipewire_fd = -1;
+    capture_->stats = new sr_stats{};
+
+    if (config_.pipewire_node.empty() && config_.pipewire_remote.empty()) {
+        // The stream is started from the portal callbacks once the user picked a source.
+        portal_ = static_cast<ScreencastPortalCapture *>(
+                screencast_portal_desktop_capture_create(config_.cursor_visible, capture_));
+        if (!portal_) {
+            stop();
+            return false;
+        }
+        return true;
+    }
+
+    // A node id or name, resolved by the session manager, which picks a video source itself
+    // when there is none.
+    capture_->target = config_.pipewire_node;
+    capture_->remote = config_.pipewire_remote;
+
+    if (!pw_capture_start(capture_)) {
+        stop();
+        return false;
+    }
+    return true;
+}
+
+void Recorder::stop() {
+    if (!capture_ || stopped_)
+        return;
+    stopped_ = true;
+
+    // The capture itself lives on until the destructor, so acquire_frame callers that are
+    // woken up here never touch freed memory.
+    pw_capture_stop(capture_, config_.stop_timeout_ms);
+    if (portal_) {
+        screencast_portal_capture_destroy(portal_);
+        portal_ = nullptr;
+    }
+}
+
+bool Recorder::acquire_frame(recorder_frame *frame, int timeout_ms) {
+    return capture_ && config_.pull_frames && pw_capture_acquire(capture_, frame, timeout_ms);
+}
+
+void Recorder::release_frame(const recorder_frame &frame) {
+    if (capture_)
+        pw_capture_release(capture_, &frame);
+}
+
+bool Recorder::stats(recorder_stats *stats) const {
+    if (!capture_)
+        return false;
+    pw_capture_counters(capture_, stats);
+    return true;
+}
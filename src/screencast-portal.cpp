@@ -4,77 +4,37 @@
 #include <gio/gunixfdlist.h>
 #include <pipewire/pipewire.h>
 
+#include "log.h"
 #include "pipewire.h"
 #include "portal.h"
 #include "screencast-portal.hpp"
 
-static GDBusProxy *screencast_proxy = nullptr;
-
-void ensure_screencast_portal_proxy() {
+// Each capture has its own proxy, so captures never share portal state beyond the session
+// bus connection.
+static GDBusProxy *create_screencast_proxy() {
     g_autoptr(GError) error = nullptr;
-    if (!screencast_proxy) {
-        screencast_proxy = g_dbus_proxy_new_sync(
-                portal_get_dbus_connection(), G_DBUS_PROXY_FLAGS_NONE, nullptr,
-                "org.freedesktop.portal.Desktop", "/org/freedesktop/portal/desktop",
-                "org.freedesktop.portal.ScreenCast", NULL, &error);
-
-        if (error) {
-            printf("[portals] Error retrieving D-Bus proxy: %s\n", error->message);
-            return;
-        }
-    }
+    GDBusConnection *connection = portal_get_dbus_connection();
+    if (!connection)
+        return nullptr;
+
+    GDBusProxy *proxy = g_dbus_proxy_new_sync(
+            connection, G_DBUS_PROXY_FLAGS_NONE, nullptr, "org.freedesktop.portal.Desktop",
+            "/org/freedesktop/portal/desktop", "org.freedesktop.portal.ScreenCast", NULL, &error);
+    if (error)
+        sr_log("[portals] Error retrieving D-Bus proxy: %s\n", error->message);
+    return proxy;
 }
 
-GDBusProxy *get_screencast_portal_proxy() {
-    ensure_screencast_portal_proxy();
-    return screencast_proxy;
+uint32_t get_available_cursor_modes(ScreencastPortalCapture *capture) {
+    g_autoptr(GVariant) cached_cursor_modes =
+            g_dbus_proxy_get_cached_property(capture->proxy, "AvailableCursorModes");
+    return cached_cursor_modes ? g_variant_get_uint32(cached_cursor_modes) : 0;
 }
 
-uint32_t get_available_capture_types() {
-    g_autoptr(GVariant) cached_source_types = nullptr;
-
-    ensure_screencast_portal_proxy();
-
-    if (!screencast_proxy)
-        return 0;
-
-    cached_source_types =
-            g_dbus_proxy_get_cached_property(screencast_proxy, "AvailableSourceTypes");
-    const uint32_t available_source_types =
-            cached_source_types ? g_variant_get_uint32(cached_source_types) : 0;
-
-    return available_source_types;
-}
-
-uint32_t get_available_cursor_modes() {
-    g_autoptr(GVariant) cached_cursor_modes = nullptr;
-
-    ensure_screencast_portal_proxy();
-
-    if (!screencast_proxy)
-        return 0;
-
-    cached_cursor_modes =
-            g_dbus_proxy_get_cached_property(screencast_proxy, "AvailableCursorModes");
-    const uint32_t available_cursor_modes =
-            cached_cursor_modes ? g_variant_get_uint32(cached_cursor_modes) : 0;
-
-    return available_cursor_modes;
-}
-
-uint32_t get_screencast_version(void) {
-    g_autoptr(GVariant) cached_version = NULL;
-    uint32_t version;
-
-    ensure_screencast_portal_proxy();
-
-    if (!screencast_proxy)
-        return 0;
-
-    cached_version = g_dbus_proxy_get_cached_property(screencast_proxy, "version");
-    version = cached_version ? g_variant_get_uint32(cached_version) : 0;
-
-    return version;
+uint32_t get_screencast_version(ScreencastPortalCapture *capture) {
+    g_autoptr(GVariant) cached_version =
+            g_dbus_proxy_get_cached_property(capture->proxy, "version");
+    return cached_version ? g_variant_get_uint32(cached_version) : 0;
 }
 
 /* ------------------------------------------------- */
@@ -106,8 +66,10 @@ void on_pipewire_remote_opened_cb(GObject *source, GAsyncResult *res, void *user
     result =
             g_dbus_proxy_call_with_unix_fd_list_finish(G_DBUS_PROXY(source), &fd_list, res, &error);
     if (error) {
-        if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
-            printf("[pipewire] Error retrieving pipewire fd: %s\n", error->message);
+        if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+            sr_log("[pipewire] Error retrieving pipewire fd: %s\n", error->message);
+            pw_capture_fail(capture->pw, "cannot open the PipeWire remote");
+        }
         return;
     }
 
@@ -116,15 +78,17 @@ void on_pipewire_remote_opened_cb(GObject *source, GAsyncResult *res, void *user
     pipewire_fd = g_unix_fd_list_get(fd_list, fd_index, &error);
     capture->pipewireFd = pipewire_fd;
     if (error) {
-        if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
-            printf("[pipewire] Error retrieving pipewire fd: %s\n", error->message);
+        if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+            sr_log("[pipewire] Error retrieving pipewire fd: %s\n", error->message);
+            pw_capture_fail(capture->pw, "cannot open the PipeWire remote");
+        }
         return;
     }
 
-    auto pw_cap = new pw_capture{};
-    pw_cap->pipewire_fd = capture->pipewireFd;
-    pw_cap->node_id = capture->pipewireNode;
-    pw_capture_start(pw_cap);
+    capture->pw->pipewire_fd = capture->pipewireFd;
+    capture->pw->target = std::to_string(capture->pipewireNode);
+    if (!pw_capture_start(capture->pw))
+        pw_capture_fail(capture->pw, "cannot start the PipeWire stream");
 }
 
 void open_pipewire_remote(ScreencastPortalCapture *capture) {
@@ -132,7 +96,7 @@ void open_pipewire_remote(ScreencastPortalCapture *capture) {
 
     g_variant_builder_init(&builder, G_VARIANT_TYPE_VARDICT);
 
-    g_dbus_proxy_call_with_unix_fd_list(get_screencast_portal_proxy(), "OpenPipeWireRemote",
+    g_dbus_proxy_call_with_unix_fd_list(capture->proxy, "OpenPipeWireRemote",
                                         g_variant_new("(oa{sv})", capture->sessionHandle, &builder),
                                         G_DBUS_CALL_FLAGS_NONE, -1, NULL, capture->cancellable,
                                         on_pipewire_remote_opened_cb, capture);
@@ -151,7 +115,8 @@ void on_start_response_received_cb(GVariant *parameters, void *user_data) {
     g_variant_get(parameters, "(u@a{sv})", &response, &result);
 
     if (response != 0) {
-        printf("[pipewire] Failed to start screencast, denied or cancelled by user\n");
+        sr_log("[pipewire] Failed to start screencast, denied or cancelled by user\n");
+        pw_capture_fail(capture->pw, "screencast denied or cancelled");
         return;
     }
 
@@ -161,7 +126,7 @@ void on_start_response_received_cb(GVariant *parameters, void *user_data) {
 
     const size_t n_streams = g_variant_iter_n_children(&iter);
     if (n_streams != 1) {
-        printf("[pipewire] Received more than one stream when only one was expected. "
+        sr_log("[pipewire] Received more than one stream when only one was expected. "
                "This is probably a bug in the desktop portal implementation you are "
                "using.\n");
 
@@ -180,25 +145,26 @@ void on_start_response_received_cb(GVariant *parameters, void *user_data) {
 
     g_variant_iter_loop(&iter, "(u@a{sv})", &capture->pipewireNode, &stream_properties);
 
-    if (get_screencast_version() >= 4) {
+    if (get_screencast_version(capture) >= 4) {
         g_autoptr(GVariant) restore_token = nullptr;
     }
 
-    printf("[pipewire] source selected, setting up screencast\n");
+    sr_log("[pipewire] source selected, setting up screencast\n");
 
     open_pipewire_remote(capture);
 }
 
 void on_started_cb(GObject *source, GAsyncResult *res, void *user_data) {
-    (void) (user_data);
-
+    auto *capture = static_cast<ScreencastPortalCapture *>(user_data);
     g_autoptr(GVariant) result = NULL;
     g_autoptr(GError) error = NULL;
 
     result = g_dbus_proxy_call_finish(G_DBUS_PROXY(source), res, &error);
     if (error) {
-        if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
-            printf("[pipewire] Error selecting screencast source: %s\n", error->message);
+        if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+            sr_log("[pipewire] Error starting screencast: %s\n", error->message);
+            pw_capture_fail(capture->pw, "cannot start the screencast");
+        }
         return;
     }
 }
@@ -210,7 +176,7 @@ void start(struct ScreencastPortalCapture *capture) {
 
     portal_create_request_path(&request_path, &request_token);
 
-    printf("[pipewire] Asking for %s\n", capture_type_to_string(capture->capture_type));
+    sr_log("[pipewire] Asking for %s\n", capture_type_to_string(capture->capture_type));
 
     portal_signal_subscribe(request_path, capture->cancellable, on_start_response_received_cb,
                             capture);
@@ -218,9 +184,9 @@ void start(struct ScreencastPortalCapture *capture) {
     g_variant_builder_init(&builder, G_VARIANT_TYPE_VARDICT);
     g_variant_builder_add(&builder, "{sv}", "handle_token", g_variant_new_string(request_token));
 
-    g_dbus_proxy_call(get_screencast_portal_proxy(), "Start",
+    g_dbus_proxy_call(capture->proxy, "Start",
                       g_variant_new("(osa{sv})", capture->sessionHandle, "", &builder),
-                      G_DBUS_CALL_FLAGS_NONE, -1, capture->cancellable, on_started_cb, nullptr);
+                      G_DBUS_CALL_FLAGS_NONE, -1, capture->cancellable, on_started_cb, capture);
 }
 
 /* ------------------------------------------------- */
@@ -230,12 +196,13 @@ void on_select_source_response_received_cb(GVariant *parameters, void *user_data
     g_autoptr(GVariant) ret = nullptr;
     uint32_t response;
 
-    printf("[pipewire] Response to select source received\n");
+    sr_log("[pipewire] Response to select source received\n");
 
     g_variant_get(parameters, "(u@a{sv})", &response, &ret);
 
     if (response != 0) {
-        printf("[pipewire] Failed to select source, denied or cancelled by user\n");
+        sr_log("[pipewire] Failed to select source, denied or cancelled by user\n");
+        pw_capture_fail(capture->pw, "source selection denied or cancelled");
         return;
     }
 
@@ -243,13 +210,16 @@ void on_select_source_response_received_cb(GVariant *parameters, void *user_data
 }
 
 void on_source_selected_cb(GObject *source, GAsyncResult *res, void *user_data) {
+    auto *capture = static_cast<ScreencastPortalCapture *>(user_data);
     g_autoptr(GVariant) result = nullptr;
     g_autoptr(GError) error = nullptr;
 
     result = g_dbus_proxy_call_finish(G_DBUS_PROXY(source), res, &error);
     if (error) {
-        if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
-            printf("[pipewire] Error selecting screencast source: %s\n", error->message);
+        if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+            sr_log("[pipewire] Error selecting screencast source: %s\n", error->message);
+            pw_capture_fail(capture->pw, "cannot select a screencast source");
+        }
         return;
     }
 }
@@ -270,7 +240,7 @@ void select_source(struct ScreencastPortalCapture *capture) {
     g_variant_builder_add(&builder, "{sv}", "multiple", g_variant_new_boolean(FALSE));
     g_variant_builder_add(&builder, "{sv}", "handle_token", g_variant_new_string(request_token));
 
-    available_cursor_modes = get_available_cursor_modes();
+    available_cursor_modes = get_available_cursor_modes(capture);
 
     if (available_cursor_modes & PORTAL_CURSOR_MODE_METADATA)
         g_variant_builder_add(&builder, "{sv}", "cursor_mode",
@@ -282,7 +252,7 @@ void select_source(struct ScreencastPortalCapture *capture) {
         g_variant_builder_add(&builder, "{sv}", "cursor_mode",
                               g_variant_new_uint32(PORTAL_CURSOR_MODE_HIDDEN));
 
-    if (get_screencast_version() >= 4) {
+    if (get_screencast_version(capture) >= 4) {
         g_variant_builder_add(&builder, "{sv}", "persist_mode", g_variant_new_uint32(2));
         if (capture->restoreToken && *capture->restoreToken) {
             g_variant_builder_add(&builder, "{sv}", "restore_token",
@@ -290,10 +260,10 @@ void select_source(struct ScreencastPortalCapture *capture) {
         }
     }
 
-    g_dbus_proxy_call(get_screencast_portal_proxy(), "SelectSources",
+    g_dbus_proxy_call(capture->proxy, "SelectSources",
                       g_variant_new("(oa{sv})", capture->sessionHandle, &builder),
                       G_DBUS_CALL_FLAGS_NONE, -1, capture->cancellable, on_source_selected_cb,
-                      nullptr);
+                      capture);
 
     free(request_token);
     free(request_path);
@@ -310,11 +280,12 @@ void on_create_session_response_received_cb(GVariant *parameters, void *user_dat
     g_variant_get(parameters, "(u@a{sv})", &response, &result);
 
     if (response != 0) {
-        printf("[pipewire] Failed to create session, denied or cancelled by user\n");
+        sr_log("[pipewire] Failed to create session, denied or cancelled by user\n");
+        pw_capture_fail(capture->pw, "screencast session denied or cancelled");
         return;
     }
 
-    printf("[pipewire] Screencast session created\n");
+    sr_log("[pipewire] Screencast session created\n");
 
     session_handle_variant = g_variant_lookup_value(result, "session_handle", nullptr);
     capture->sessionHandle = g_variant_dup_string(session_handle_variant, nullptr);
@@ -323,15 +294,16 @@ void on_create_session_response_received_cb(GVariant *parameters, void *user_dat
 }
 
 void on_session_created_cb(GObject *source, GAsyncResult *res, void *user_data) {
-    (void) (user_data);
-
+    auto *capture = static_cast<ScreencastPortalCapture *>(user_data);
     g_autoptr(GVariant) result = nullptr;
     g_autoptr(GError) error = nullptr;
 
     result = g_dbus_proxy_call_finish(G_DBUS_PROXY(source), res, &error);
     if (error) {
-        if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
-            printf("[pipewire] Error creating screencast session: %s\n", error->message);
+        if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+            sr_log("[pipewire] Error creating screencast session: %s\n", error->message);
+            pw_capture_fail(capture->pw, "cannot create a screencast session");
+        }
         return;
     }
 }
@@ -353,26 +325,20 @@ void create_session(struct ScreencastPortalCapture *capture) {
     g_variant_builder_add(&builder, "{sv}", "session_handle_token",
                           g_variant_new_string(session_token));
 
-    g_dbus_proxy_call(get_screencast_portal_proxy(), "CreateSession",
+    g_dbus_proxy_call(capture->proxy, "CreateSession",
                       g_variant_new("(a{sv})", &builder), G_DBUS_CALL_FLAGS_NONE, -1,
-                      capture->cancellable, on_session_created_cb, nullptr);
+                      capture->cancellable, on_session_created_cb, capture);
 }
 
 /* ------------------------------------------------- */
 
 gboolean init_screencast_capture(struct ScreencastPortalCapture *capture) {
-    GDBusConnection *connection;
-    GDBusProxy *proxy;
-
     capture->cancellable = g_cancellable_new();
-    connection = portal_get_dbus_connection();
-    if (!connection)
-        return FALSE;
-    proxy = get_screencast_portal_proxy();
-    if (!proxy)
+    capture->proxy = create_screencast_proxy();
+    if (!capture->proxy)
         return FALSE;
 
-    printf("[pipewire] pipeWire initialized\n");
+    sr_log("[pipewire] pipeWire initialized\n");
 
     create_session(capture);
 
@@ -380,13 +346,16 @@ gboolean init_screencast_capture(struct ScreencastPortalCapture *capture) {
 }
 
 
-void *screencast_portal_desktop_capture_create(bool cursorVisible) {
+void *screencast_portal_desktop_capture_create(bool cursorVisible, pw_capture *pw) {
     const auto capture = new ScreencastPortalCapture{};
     capture->capture_type = SR_PORTAL_CAPTURE_TYPE_WINDOW;
     capture->cursorVisible = cursorVisible;
+    capture->pw = pw;
 
-    init_screencast_capture(capture);
-
+    if (!init_screencast_capture(capture)) {
+        screencast_portal_capture_destroy(capture);
+        return nullptr;
+    }
     return capture;
 }
 
@@ -406,7 +375,6 @@ void screencast_portal_capture_destroy(void *data) {
 
     g_cancellable_cancel(capture->cancellable);
     g_clear_object(&capture->cancellable);
+    g_clear_object(&capture->proxy);
+    delete capture;
 }
-
-
-void screencast_portal_unload() { g_clear_object(&screencast_proxy); }
@@ -21,10 +21,13 @@ enum SrPortalCaptureType {
     SR_PORTAL_CAPTURE_TYPE_UNIFIED = PORTAL_CAPTURE_TYPE_MONITOR | PORTAL_CAPTURE_TYPE_WINDOW,
 };
 
+struct pw_capture;
+
 struct ScreencastPortalCapture {
     SrPortalCaptureType capture_type;
 
     GCancellable *cancellable;
+    GDBusProxy *proxy;
 
     char *sessionHandle;
     char *restoreToken;
@@ -34,9 +37,9 @@ struct ScreencastPortalCapture {
     bool test_is_good;
 
     int pipewireFd;
+    pw_capture *pw; // started once the portal hands over the PipeWire remote
 };
 
-void *
-screencast_portal_desktop_capture_create(bool cursorVisible); // NOLINT(*-use-trailing-return-type)
+// NOLINTNEXTLINE(*-use-trailing-return-type)
+void *screencast_portal_desktop_capture_create(bool cursorVisible, pw_capture *pw);
 void screencast_portal_capture_destroy(void *data);
-void screencast_portal_unload();
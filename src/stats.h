@@ -0,0 +1,69 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <sys/resource.h>
+
+#include "thread-policy.h"
+#include "log.h"
+
+#define SR_STATS_INTERVAL_NS 5000000000ull
+
+struct sr_stats {
+    std::atomic<uint64_t> captured{0};
+    std::atomic<uint64_t> dropped{0}; // before reaching any output; outputs count their own
+    std::atomic<uint64_t> zero_copy{0};
+    std::atomic<uint64_t> copied{0};
+    sched_placements placements; // threads of this capture, for the report
+
+    uint64_t last_report_ns = 0;
+    uint64_t last_captured = 0;
+    long last_minor_faults = 0;
+    long last_major_faults = 0;
+};
+
+static uint64_t now_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static rusage stats_usage() {
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage;
+}
+
+// Prints a summary line at most every SR_STATS_INTERVAL_NS and returns whether it did.
+// Called from the capture thread.
+static bool stats_report(sr_stats *stats, uint64_t now) {
+    if (stats->last_report_ns == 0) {
+        const rusage usage = stats_usage();
+        stats->last_report_ns = now;
+        stats->last_minor_faults = usage.ru_minflt;
+        stats->last_major_faults = usage.ru_majflt;
+        return false;
+    }
+    if (now - stats->last_report_ns < SR_STATS_INTERVAL_NS)
+        return false;
+
+    const uint64_t captured = stats->captured.load();
+    const rusage usage = stats_usage();
+    const uint64_t frames = captured - stats->last_captured;
+
+    sr_log("[stats] captured %lu (zero-copy %lu, copied %lu), dropped %lu, "
+           "page faults/frame %.2f minor, %.2f major\n",
+           (unsigned long) captured, (unsigned long) stats->zero_copy.load(),
+           (unsigned long) stats->copied.load(), (unsigned long) stats->dropped.load(),
+           frames ? (double) (usage.ru_minflt - stats->last_minor_faults) / frames : 0.0,
+           frames ? (double) (usage.ru_majflt - stats->last_major_faults) / frames : 0.0);
+    sched_report(&stats->placements);
+
+    stats->last_report_ns = now;
+    stats->last_captured = captured;
+    stats->last_minor_faults = usage.ru_minflt;
+    stats->last_major_faults = usage.ru_majflt;
+    return true;
+}
@@ -0,0 +1,275 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <gio/gio.h>
+
+#include "thread-policy.h"
+#include "log.h"
+
+#define RTKIT_TIMEOUT_MS 2000
+#define RTKIT_RTTIME_US 200000
+
+static const char *role_names[SR_ROLE_COUNT] = {"capture", "process", "writer", "encoder"};
+
+const char *sched_role_name(sr_thread_role role) { return role_names[role]; }
+
+static thread_policy *policy_for(const char *arg, thread_policy *policies, const char **value) {
+    const char *eq = strchr(arg, '=');
+    if (!eq)
+        return nullptr;
+    for (int role = 0; role < SR_ROLE_COUNT; role++) {
+        if (strlen(role_names[role]) == (size_t) (eq - arg) &&
+            strncmp(arg, role_names[role], eq - arg) == 0) {
+            *value = eq + 1;
+            return &policies[role];
+        }
+    }
+    return nullptr;
+}
+
+bool sched_parse_affinity(const char *arg, thread_policy *policies) {
+    const char *list;
+    thread_policy *policy = policy_for(arg, policies, &list);
+    if (!policy)
+        return false;
+
+    CPU_ZERO(&policy->cpus);
+    for (const char *p = list; *p;) {
+        char *end;
+        const long first = strtol(p, &end, 10);
+        long last = first;
+        if (end == p || first < 0)
+            return false;
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+            if (end == p || last < first)
+                return false;
+        }
+        for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++)
+            CPU_SET(cpu, &policy->cpus);
+        p = *end == ',' ? end + 1 : end;
+        if (*end && *end != ',')
+            return false;
+    }
+    policy->has_cpus = CPU_COUNT(&policy->cpus) > 0;
+    return policy->has_cpus;
+}
+
+bool sched_parse_policy(const char *arg, thread_policy *policies) {
+    const char *spec;
+    thread_policy *policy = policy_for(arg, policies, &spec);
+    if (!policy)
+        return false;
+
+    int value = 0;
+    if (sscanf(spec, "fifo:%d", &value) == 1) {
+        policy->policy = SCHED_FIFO;
+        policy->priority = value;
+    } else if (sscanf(spec, "other:%d", &value) == 1) {
+        policy->policy = SCHED_OTHER;
+        policy->nice = value;
+    } else {
+        return false;
+    }
+    policy->has_sched = true;
+    return true;
+}
+
+/* ------------------------------------------------- */
+
+static bool rtkit_call(const char *method, GVariant *parameters) {
+    // GIO shares the system bus connection process-wide; the reference is only held per call.
+    g_autoptr(GError) bus_error = nullptr;
+    g_autoptr(GDBusConnection) connection = g_bus_get_sync(G_BUS_TYPE_SYSTEM, nullptr, &bus_error);
+    if (!connection) {
+        sr_log("[sched] Error retrieving system bus: %s\n", bus_error->message);
+        g_variant_unref(parameters);
+        return false;
+    }
+
+    g_autoptr(GError) error = nullptr;
+    GVariant *reply = g_dbus_connection_call_sync(
+            connection, "org.freedesktop.RealtimeKit1", "/org/freedesktop/RealtimeKit1",
+            "org.freedesktop.RealtimeKit1", method, parameters, nullptr, G_DBUS_CALL_FLAGS_NONE,
+            RTKIT_TIMEOUT_MS, nullptr, &error);
+    if (!reply) {
+        sr_log("[sched] rtkit %s failed: %s\n", method, error->message);
+        return false;
+    }
+    g_variant_unref(reply);
+    return true;
+}
+
+static void limit_rttime() {
+    // rtkit only grants realtime scheduling to processes that bound their CPU time.
+    rlimit limit{RTKIT_RTTIME_US, RTKIT_RTTIME_US};
+    setrlimit(RLIMIT_RTTIME, &limit);
+}
+
+static bool rtkit_apply(const thread_policy *policy, pid_t pid, pid_t tid) {
+    if (policy->policy == SCHED_FIFO) {
+        // Other processes, i.e. the encoder, set their own limit before exec.
+        if (pid == getpid())
+            limit_rttime();
+        return rtkit_call("MakeThreadRealtimeWithPID",
+                          g_variant_new("(ttu)", (guint64) pid, (guint64) tid,
+                                        (guint32) policy->priority));
+    }
+    return rtkit_call("MakeThreadHighPriorityWithPID",
+                      g_variant_new("(tti)", (guint64) pid, (guint64) tid, (gint) policy->nice));
+}
+
+static int set_scheduler(const thread_policy *policy, pid_t tid) {
+    sched_param param{};
+    param.sched_priority = policy->policy == SCHED_FIFO ? policy->priority : 0;
+    if (sched_setscheduler(tid, policy->policy, &param) != 0)
+        return -1;
+    if (policy->policy == SCHED_OTHER && setpriority(PRIO_PROCESS, tid, policy->nice) != 0)
+        return -1;
+    return 0;
+}
+
+void sched_apply(sr_thread_role role, const thread_policy *policy, pid_t pid, pid_t tid,
+                 sched_placements *placements) {
+    if (pid == 0)
+        pid = getpid();
+    if (tid == 0)
+        tid = static_cast<pid_t>(syscall(SYS_gettid));
+    if (placements) {
+        std::lock_guard guard(placements->lock);
+        auto &placed = placements->placed;
+        auto it = std::find_if(placed.begin(), placed.end(),
+                               [tid](const sched_placements::placement &placement) {
+                                   return placement.tid == tid;
+                               });
+        if (it != placed.end())
+            *it = {role, pid, tid, false};
+        else
+            placed.push_back({role, pid, tid, false});
+    }
+
+    if (policy->has_cpus && sched_setaffinity(tid, sizeof(cpu_set_t), &policy->cpus) != 0)
+        sr_log("[sched] cannot set %s affinity: %s\n", role_names[role], strerror(errno));
+
+    if (!policy->has_sched || set_scheduler(policy, tid) == 0)
+        return;
+
+    const int err = errno;
+    if (policy->use_rtkit && rtkit_apply(policy, pid, tid)) {
+        if (placements) {
+            std::lock_guard guard(placements->lock);
+            for (sched_placements::placement &placement : placements->placed) {
+                if (placement.tid == tid)
+                    placement.via_rtkit = true;
+            }
+        }
+        return;
+    }
+    sr_log("[sched] cannot set %s scheduling: %s\n", role_names[role], strerror(err));
+}
+
+void sched_forget(sched_placements *placements, pid_t tid) {
+    if (!placements)
+        return;
+    if (tid == 0)
+        tid = static_cast<pid_t>(syscall(SYS_gettid));
+    std::lock_guard guard(placements->lock);
+    auto &placed = placements->placed;
+    placed.erase(std::remove_if(placed.begin(), placed.end(),
+                                [tid](const sched_placements::placement &placement) {
+                                    return placement.tid == tid;
+                                }),
+                 placed.end());
+}
+
+void sched_apply_child(const thread_policy *policy) {
+    // Set before exec, so rtkit finds the limit on the encoder if it has to step in.
+    if (policy->has_sched && policy->policy == SCHED_FIFO && policy->use_rtkit)
+        limit_rttime();
+    if (policy->has_cpus)
+        sched_setaffinity(0, sizeof(cpu_set_t), &policy->cpus);
+    if (policy->has_sched)
+        set_scheduler(policy, 0);
+}
+
+/* ------------------------------------------------- */
+
+static std::string format_cpus(const cpu_set_t *cpus) {
+    std::string out;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, cpus))
+            continue;
+        int last = cpu;
+        while (last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, cpus))
+            last++;
+        if (!out.empty())
+            out += ',';
+        out += std::to_string(cpu);
+        if (last > cpu)
+            out += '-' + std::to_string(last);
+        cpu = last;
+    }
+    return out;
+}
+
+// Field 39 of /proc/PID/task/TID/stat is the CPU the thread last ran on.
+static int last_cpu(pid_t pid, pid_t tid) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/task/%d/stat", pid, tid);
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return -1;
+
+    char line[1024];
+    const bool ok = fgets(line, sizeof(line), f) != nullptr;
+    fclose(f);
+    const char *p = ok ? strrchr(line, ')') : nullptr;
+    if (!p)
+        return -1;
+
+    // Fields after the command name start at field 3.
+    int field = 2, cpu = -1;
+    for (const char *tok = p + 1; *tok && field < 39; tok++) {
+        if (*tok == ' ' && ++field == 39)
+            cpu = atoi(tok + 1);
+    }
+    return cpu;
+}
+
+void sched_report(sched_placements *placements) {
+    std::vector<sched_placements::placement> current;
+    {
+        std::lock_guard guard(placements->lock);
+        current = placements->placed;
+    }
+
+    for (const sched_placements::placement &placement : current) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        const bool has_cpus = sched_getaffinity(placement.tid, sizeof(cpus), &cpus) == 0;
+        const int policy = sched_getscheduler(placement.tid);
+        sched_param param{};
+        sched_getparam(placement.tid, &param);
+        // -1 is a valid nice value, so only errno tells a failure apart.
+        errno = 0;
+        const int nice = getpriority(PRIO_PROCESS, placement.tid);
+        const bool has_nice = errno == 0;
+
+        const std::string cpu_list = has_cpus ? format_cpus(&cpus) : "?";
+        const std::string nice_value = has_nice ? std::to_string(nice) : "?";
+        const std::string sched = policy == SCHED_FIFO
+                                          ? "SCHED_FIFO " + std::to_string(param.sched_priority)
+                                          : "SCHED_OTHER nice " + nice_value;
+        sr_log("[stats] %s tid %d: cpus %s, %s, last cpu %d%s\n", role_names[placement.role],
+               placement.tid, cpu_list.c_str(), sched.c_str(),
+               last_cpu(placement.pid, placement.tid), placement.via_rtkit ? " (rtkit)" : "");
+    }
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <mutex>
+#include <sched.h>
+#include <sys/types.h>
+#include <vector>
+
+#include "recorder.h"
+
+// Applies and reports the per-role thread_policy of recorder.h.
+
+// Every thread and process sched_apply placed and that is still around, for sched_report.
+// One per Recorder, so Recorders running side by side report their own threads.
+struct sched_placements {
+    struct placement {
+        sr_thread_role role;
+        pid_t pid;
+        pid_t tid;
+        bool via_rtkit;
+    };
+    std::mutex lock;
+    std::vector<placement> placed;
+};
+
+const char *sched_role_name(sr_thread_role role);
+
+// Parses ROLE=CPULIST (e.g. "capture=2-3,6") into the matching entry of policies.
+bool sched_parse_affinity(const char *arg, thread_policy *policies);
+// Parses ROLE=fifo:PRIORITY or ROLE=other:NICE into the matching entry of policies.
+bool sched_parse_policy(const char *arg, thread_policy *policies);
+
+// Applies policy to thread tid of process pid (0 for the calling thread) and records it in
+// placements, when given, for sched_report. With rtkit this may block on D-Bus, so it is never
+// called from the capture path itself. Must not be called between fork and exec.
+void sched_apply(sr_thread_role role, const thread_policy *policy, pid_t pid, pid_t tid,
+                 sched_placements *placements);
+// Drops thread tid (0 for the calling thread), or the process of that pid once reaped, from
+// placements before it goes away.
+void sched_forget(sched_placements *placements, pid_t tid);
+
+// Async-signal-safe subset of sched_apply for a freshly forked child before exec: affinity,
+// scheduling class and, when rtkit may be asked for SCHED_FIFO, the RLIMIT_RTTIME it requires.
+void sched_apply_child(const thread_policy *policy);
+
+// Prints the placement every recorded thread and process actually ended up with.
+void sched_report(sched_placements *placements);
@@ -1,18 +1,18 @@
 #pragma once
 
+#include <algorithm>
 #include <cmath>
+#include <cstdlib>
 #include <ctime>
 #include <getopt.h>
 #include <iostream>
 #include <string>
+#include <vector>
 
-using std::string;
+#include "encoder.h"
+#include "thread-policy.h"
 
-class WindowMonitor {
-public:
-    static inline uint width;
-    static inline uint height;
-};
+using std::string;
 
 class SROptions {
 public:
@@ -22,7 +22,23 @@ public:
     static inline uint inputFpsNum = 1;
     static inline uint inputFpsDen = 1;
     static inline uint outputFps = 30;
+    static inline int crf = 30;
+    static inline string preset = "ultrafast";
+    static inline uint workers = 1;
+    static inline uint segmentSeconds = 2;
+    static inline bool adaptive = false;
+    static inline float cpuBudget = 0.0f;
     static inline string outputFile;
+    static inline string frameBusPath;
+    static inline string pipewireNode;
+    static inline string pipewireRemote;
+    static inline uint poolFrames = 4;
+    static inline uint pwBuffers = 8;
+    static inline uint stopTimeoutMs = 5000;
+    static inline bool calibrate = false;
+    static inline bool recalibrate = false;
+    static inline thread_policy threadPolicies[SR_ROLE_COUNT];
+    static inline std::vector<output_profile> outputs;
 };
 
 static void parse_cli(int argc, char *argv[]) {
@@ -30,21 +46,42 @@ static void parse_cli(int argc, char *argv[]) {
                                     {"output-fps", required_argument, 0, 'o'},
                                     {"resolution", required_argument, 0, 'r'},
                                     {"output", required_argument, 0, 'f'},
+                                    {"frame-bus", required_argument, 0, 'b'},
+                                    {"pool-frames", required_argument, 0, 'p'},
+                                    {"affinity", required_argument, 0, 'a'},
+                                    {"sched", required_argument, 0, 'S'},
+                                    {"rtkit", no_argument, 0, 'R'},
+                                    {"add-output", required_argument, 0, 'O'},
+                                    {"pw-buffers", required_argument, 0, 'B'},
+                                    {"crf", required_argument, 0, 'c'},
+                                    {"preset", required_argument, 0, 'P'},
+                                    {"workers", required_argument, 0, 'w'},
+                                    {"segment-seconds", required_argument, 0, 'g'},
+                                    {"adaptive", no_argument, 0, 'A'},
+                                    {"cpu-budget", required_argument, 0, 'C'},
+                                    {"stop-timeout", required_argument, 0, 'T'},
+                                    {"calibrate", optional_argument, 0, 'K'},
+                                    {"pipewire-node", required_argument, 0, 'n'},
+                                    {"pipewire-remote", required_argument, 0, 'u'},
                                     {"help", no_argument, 0, 'h'},
                                     {0, 0, 0, 0}};
 
     int opt;
-    while ((opt = getopt_long(argc, argv, "i:o:r:f:h", long_options, nullptr)) != -1) {
+    const char *short_options = "i:o:r:f:b:p:a:S:RO:B:c:P:w:g:AC:T:K::n:u:h";
+    while ((opt = getopt_long(argc, argv, short_options, long_options, nullptr)) != -1) {
         switch (opt) {
             case 'i':
                 int num, denom;
-                if (sscanf(optarg, "%d/%d", &num, &denom) == 2) {
-                    SROptions::inputFpsNum = num;
-                    SROptions::inputFpsDen = denom;
+                if (sscanf(optarg, "%d/%d", &num, &denom) != 2 || num <= 0 || denom <= 0) {
+                    std::cerr << "[Utils] Invalid input fps, use NUM/DEN with both above 0\n";
+                    std::exit(1);
                 }
+                SROptions::inputFpsNum = num;
+                SROptions::inputFpsDen = denom;
                 break;
             case 'o':
-                SROptions::outputFps = std::atoi(optarg);
+                // As fps= in --output: the rate divides the frame period and segment lengths.
+                SROptions::outputFps = std::max(1, std::atoi(optarg));
                 break;
             case 'r': {
                 int w = 0, h = 0;
@@ -60,10 +97,91 @@ static void parse_cli(int argc, char *argv[]) {
             case 'f':
                 SROptions::outputFile = optarg;
                 break;
+            case 'b':
+                SROptions::frameBusPath = optarg;
+                break;
+            case 'p':
+                SROptions::poolFrames = std::max(2, std::atoi(optarg));
+                break;
+            case 'c':
+                SROptions::crf = std::atoi(optarg);
+                break;
+            case 'P':
+                SROptions::preset = optarg;
+                break;
+            case 'w':
+                SROptions::workers = std::max(1, std::atoi(optarg));
+                break;
+            case 'g':
+                SROptions::segmentSeconds = std::max(1, std::atoi(optarg));
+                break;
+            case 'A':
+                SROptions::adaptive = true;
+                break;
+            case 'C':
+                SROptions::cpuBudget = std::max(0.0f, std::strtof(optarg, nullptr));
+                break;
+            case 'K':
+                SROptions::calibrate = true;
+                if (optarg && std::string(optarg) == "refresh") {
+                    SROptions::recalibrate = true;
+                } else if (optarg) {
+                    std::cerr << "[Utils] Invalid calibration, use --calibrate or "
+                                 "--calibrate=refresh\n";
+                    std::exit(1);
+                }
+                break;
+            case 'n':
+                SROptions::pipewireNode = optarg;
+                break;
+            case 'u':
+                SROptions::pipewireRemote = optarg;
+                break;
+            case 'T':
+                SROptions::stopTimeoutMs = std::max(0, std::atoi(optarg));
+                break;
+            case 'B':
+                SROptions::pwBuffers = std::clamp(std::atoi(optarg), 2, 32);
+                break;
+            case 'a':
+                if (!sched_parse_affinity(optarg, SROptions::threadPolicies)) {
+                    std::cerr << "[Utils] Invalid affinity, use ROLE=CPULIST with ROLE one of "
+                                 "capture, process, writer, encoder\n";
+                    std::exit(1);
+                }
+                break;
+            case 'S':
+                if (!sched_parse_policy(optarg, SROptions::threadPolicies)) {
+                    std::cerr << "[Utils] Invalid scheduling, use ROLE=fifo:PRIORITY or "
+                                 "ROLE=other:NICE\n";
+                    std::exit(1);
+                }
+                break;
+            case 'R':
+                for (auto &policy : SROptions::threadPolicies)
+                    policy.use_rtkit = true;
+                break;
+            case 'O': {
+                output_profile profile;
+                if (!output_profile_parse(optarg, &profile)) {
+                    std::cerr << "[Utils] Invalid output, use "
+                                 "size=WxH,fps=N,every=N,crf=N,preset=NAME,workers=N,segment=N,"
+                                 "adaptive=0|1,budget=CORES,file=PATH\n";
+                    std::exit(1);
+                }
+                SROptions::outputs.push_back(profile);
+                break;
+            }
             case 'h':
             default:
                 std::cout << "[Utils] Usage: program [--input-fps N/N] [--output-fps N] "
-                             "[--resolution WxH] [--output FILE]\n";
+                             "[--resolution WxH] [--output FILE] [--crf N] [--preset NAME] "
+                             "[--workers N] [--segment-seconds N] [--adaptive] "
+                             "[--cpu-budget CORES] [--stop-timeout MS] [--calibrate[=refresh]] "
+                             "[--frame-bus SOCKET] [--pool-frames N] [--pw-buffers N] "
+                             "[--affinity ROLE=CPUS] [--sched ROLE=POLICY] [--rtkit] "
+                             "[--add-output SPEC]... [--pipewire-node ID|NAME] "
+                             "[--pipewire-remote SOCKET]\n";
                 std::exit(0);
         }
     }
@@ -74,4 +192,17 @@ static void parse_cli(int argc, char *argv[]) {
         std::strftime(buf, sizeof(buf), "record_%Y%m%d_%H%M%S.mp4", std::localtime(&t));
         SROptions::outputFile = buf;
     }
+
+    output_profile primary;
+    primary.width = SROptions::outputWidth;
+    primary.height = SROptions::outputHeight;
+    primary.fps = SROptions::outputFps;
+    primary.crf = SROptions::crf;
+    primary.preset = SROptions::preset;
+    primary.workers = SROptions::workers;
+    primary.segment_seconds = SROptions::segmentSeconds;
+    primary.adaptive = SROptions::adaptive;
+    primary.cpu_budget = SROptions::cpuBudget;
+    primary.file = SROptions::outputFile;
+    SROptions::outputs.insert(SROptions::outputs.begin(), primary);
 }
@@ -0,0 +1,195 @@
+// Frame bus test: a fake producer publishes frames whose bytes are derived from their index,
+// and a consumer attached over the socket checks frame index, pts and content of everything
+// it reads, first in lockstep and then against a producer running flat out.
+
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <tuple>
+#include <unistd.h>
+#include <vector>
+
+#include "../src/frame-bus.h"
+
+#define WIDTH 64
+#define HEIGHT 32
+#define STRIDE (WIDTH * 4)
+#define FRAME_SIZE (STRIDE * HEIGHT)
+#define PTS_BASE 1000000ull
+
+static int failures = 0;
+
+#define CHECK(cond)                                                                            \
+    do {                                                                                       \
+        if (!(cond)) {                                                                         \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);          \
+            failures++;                                                                        \
+        }                                                                                      \
+    } while (0)
+
+static void fill_frame(uint8_t *frame, uint64_t index) {
+    for (size_t i = 0; i < FRAME_SIZE; i++)
+        frame[i] = static_cast<uint8_t>(index * 31 + i * 7 + (i >> 8));
+}
+
+static bool frame_matches(const uint8_t *frame, uint64_t index) {
+    for (size_t i = 0; i < FRAME_SIZE; i++) {
+        if (frame[i] != static_cast<uint8_t>(index * 31 + i * 7 + (i >> 8)))
+            return false;
+    }
+    return true;
+}
+
+static void test_lockstep(frame_bus *bus, const frame_bus_view *view) {
+    std::vector<uint8_t> produced(FRAME_SIZE), consumed(FRAME_SIZE);
+    frame_bus_frame info{};
+    CHECK(!frame_bus_read_latest(view, consumed.data(), consumed.size(), &info));
+
+    for (uint64_t index = 0; index < 40; index++) {
+        fill_frame(produced.data(), index);
+        frame_bus_publish(bus, produced.data(), STRIDE, PTS_BASE + index);
+
+        CHECK(frame_bus_wait(view, index, 0) == index + 1);
+        CHECK(frame_bus_read_latest(view, consumed.data(), consumed.size(), &info));
+        CHECK(info.frame_index == index);
+        CHECK(info.pts_ns == PTS_BASE + index);
+        CHECK(info.size == FRAME_SIZE);
+        CHECK(frame_matches(consumed.data(), index));
+    }
+}
+
+// Neither the received descriptor nor a read-write reopen of it may be written through.
+static void test_read_only(const frame_bus_view *view) {
+    void *map = mmap(nullptr, view->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, view->fd, 0);
+    CHECK(map == MAP_FAILED);
+    if (map != MAP_FAILED)
+        munmap(map, view->map_size);
+
+    char proc_path[64];
+    snprintf(proc_path, sizeof(proc_path), "/proc/self/fd/%d", view->fd);
+    const int fd = open(proc_path, O_RDWR | O_CLOEXEC);
+    if (fd < 0)
+        return;
+    map = mmap(nullptr, view->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    CHECK(map == MAP_FAILED);
+    if (map != MAP_FAILED)
+        munmap(map, view->map_size);
+    const char byte = 0;
+    CHECK(pwrite(fd, &byte, 1, 0) < 0);
+    close(fd);
+}
+
+// The producer never waits, so the consumer misses frames and sometimes loses a slot to an
+// overwrite, but whatever it does read must be one complete, correctly labelled frame.
+static void test_free_running(frame_bus *bus, const frame_bus_view *view) {
+    constexpr uint64_t first = 40, frames = 20000;
+    std::atomic<bool> done{false};
+    std::thread producer([bus, &done] {
+        std::vector<uint8_t> frame(FRAME_SIZE);
+        for (uint64_t index = first; index < first + frames; index++) {
+            fill_frame(frame.data(), index);
+            frame_bus_publish(bus, frame.data(), STRIDE, PTS_BASE + index);
+        }
+        done = true;
+    });
+
+    std::vector<uint8_t> consumed(FRAME_SIZE);
+    uint64_t seen = first, received = 0, last = 0;
+    bool ordered = true, intact = true;
+    while (!done || seen < first + frames) {
+        const uint64_t published = frame_bus_wait(view, seen, 100);
+        if (published <= seen)
+            continue;
+        frame_bus_frame info{};
+        if (!frame_bus_read_latest(view, consumed.data(), consumed.size(), &info)) {
+            seen = published;
+            continue;
+        }
+        ordered &= info.frame_index >= last && info.pts_ns == PTS_BASE + info.frame_index;
+        intact &= frame_matches(consumed.data(), info.frame_index);
+        last = info.frame_index;
+        seen = info.frame_index + 1;
+        received++;
+    }
+    producer.join();
+
+    CHECK(ordered);
+    CHECK(intact);
+    CHECK(received > 0);
+    CHECK(last == first + frames - 1);
+    printf("free running: read %lu of %lu frames intact\n", (unsigned long) received,
+           (unsigned long) frames);
+}
+
+// Rows of a source frame with padding, as PipeWire buffers may have, are packed to the bus
+// stride.
+static void test_padded(frame_bus *bus, const frame_bus_view *view) {
+    constexpr uint32_t padded = STRIDE + 64;
+    std::vector<uint8_t> tight(FRAME_SIZE), source(padded * HEIGHT, 0xee), consumed(FRAME_SIZE);
+    const uint64_t index = bus->header->published;
+    fill_frame(tight.data(), index);
+    for (uint32_t y = 0; y < HEIGHT; y++)
+        memcpy(source.data() + y * padded, tight.data() + y * STRIDE, STRIDE);
+    frame_bus_publish(bus, source.data(), padded, PTS_BASE + index);
+
+    frame_bus_frame info{};
+    CHECK(frame_bus_wait(view, index, 0) == index + 1);
+    CHECK(frame_bus_read_latest(view, consumed.data(), consumed.size(), &info));
+    CHECK(info.frame_index == index);
+    CHECK(info.size == FRAME_SIZE);
+    CHECK(frame_matches(consumed.data(), index));
+}
+
+int main() {
+    char dir[] = "/tmp/sr-frame-bus-test-XXXXXX";
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    const std::string socket_path = std::string(dir) + "/bus.sock";
+
+    frame_bus bus;
+    if (!frame_bus_create(&bus, socket_path.c_str(), WIDTH, HEIGHT, STRIDE, 0, 4)) {
+        rmdir(dir);
+        return 1;
+    }
+
+    frame_bus_view view;
+    CHECK(frame_bus_attach(&view, socket_path.c_str()));
+    if (view.header) {
+        CHECK(view.header->width == WIDTH && view.header->height == HEIGHT);
+        CHECK(view.header->stride == STRIDE && view.header->slot_count == 4);
+        test_lockstep(&bus, &view);
+        test_read_only(&view);
+        test_free_running(&bus, &view);
+        test_padded(&bus, &view);
+    }
+
+    frame_bus_detach(&view);
+    frame_bus_destroy(&bus);
+    rmdir(dir);
+
+    // Default ring size: bounded in bytes, not a fixed slot count.
+    const std::string sized_path = socket_path + ".sized";
+    for (const auto &[width, height, slots] :
+         {std::tuple{1920u, 1080u, 16u}, std::tuple{3840u, 2160u, 4u}}) {
+        frame_bus sized;
+        mkdir(dir, 0700);
+        CHECK(frame_bus_create(&sized, sized_path.c_str(), width, height, width * 4, 0, 0));
+        if (sized.header)
+            CHECK(sized.header->slot_count == slots);
+        frame_bus_destroy(&sized);
+        rmdir(dir);
+    }
+
+    if (failures)
+        fprintf(stderr, "%d checks failed\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,101 @@
+// Page faults per frame for the intermediate buffers of one captured frame (a BGRA copy and
+// its I420 conversion), allocated with malloc for every frame versus taken from preallocated
+// frame pools. Prints minor and major faults per frame for both; fails when the pool path
+// faults at all in steady state.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/resource.h>
+#include <vector>
+
+#include "../src/convert.h"
+#include "../src/frame-pool.h"
+
+#define FRAMES 60
+
+struct faults {
+    double minor;
+    double major;
+};
+
+static rusage usage_now() {
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage;
+}
+
+static faults per_frame(const rusage &before, const rusage &after) {
+    return {static_cast<double>(after.ru_minflt - before.ru_minflt) / FRAMES,
+            static_cast<double>(after.ru_majflt - before.ru_majflt) / FRAMES};
+}
+
+static faults malloc_path(const std::vector<uint8_t> &source, uint32_t width, uint32_t height) {
+    const uint32_t stride = width * 4;
+    const uint32_t uv_width = (width + 1) / 2, uv_height = (height + 1) / 2;
+    const size_t i420_size = static_cast<size_t>(width) * height + 2 * uv_width * uv_height;
+
+    const rusage before = usage_now();
+    for (int i = 0; i < FRAMES; i++) {
+        auto *bgra = static_cast<uint8_t *>(malloc(source.size()));
+        auto *i420 = static_cast<uint8_t *>(malloc(i420_size));
+        memcpy(bgra, source.data(), source.size());
+        i420_planes planes{};
+        planes.y = i420;
+        planes.u = i420 + static_cast<size_t>(width) * height;
+        planes.v = planes.u + static_cast<size_t>(uv_width) * uv_height;
+        planes.y_stride = width;
+        planes.uv_stride = uv_width;
+        planes.width = width;
+        planes.height = height;
+        bgra_to_i420(bgra, stride, &planes);
+        free(i420);
+        free(bgra);
+    }
+    return per_frame(before, usage_now());
+}
+
+static faults pool_path(const std::vector<uint8_t> &source, uint32_t width, uint32_t height) {
+    frame_pool capture, converted;
+    if (!frame_pool_init(&capture, FRAME_FORMAT_BGRA, width, height, 4) ||
+        !frame_pool_init(&converted, FRAME_FORMAT_I420, width, height, 4))
+        exit(1);
+
+    const rusage before = usage_now();
+    for (int i = 0; i < FRAMES; i++) {
+        uint8_t *bgra = frame_pool_acquire(&capture);
+        uint8_t *i420 = frame_pool_acquire(&converted);
+        for (uint32_t y = 0; y < height; y++)
+            memcpy(bgra + static_cast<size_t>(y) * capture.stride,
+                   source.data() + static_cast<size_t>(y) * width * 4, width * 4);
+        const i420_planes planes = frame_pool_i420(&converted, i420);
+        bgra_to_i420(bgra, capture.stride, &planes);
+        frame_pool_release(&converted, i420);
+        frame_pool_release(&capture, bgra);
+    }
+    const faults result = per_frame(before, usage_now());
+
+    frame_pool_destroy(&capture);
+    frame_pool_destroy(&converted);
+    return result;
+}
+
+int main() {
+    int failures = 0;
+    const uint32_t sizes[][2] = {{1920, 1080}, {3840, 2160}};
+    for (const auto &size : sizes) {
+        const uint32_t width = size[0], height = size[1];
+        std::vector<uint8_t> source(static_cast<size_t>(width) * 4 * height);
+        for (size_t i = 0; i < source.size(); i++)
+            source[i] = static_cast<uint8_t>(i * 13);
+
+        const faults before = malloc_path(source, width, height);
+        const faults after = pool_path(source, width, height);
+        printf("%ux%u page faults/frame: malloc %.1f minor, %.1f major; pool %.1f minor, "
+               "%.1f major\n",
+               width, height, before.minor, before.major, after.minor, after.major);
+        if (after.minor + after.major >= 1.0)
+            failures++;
+    }
+    return failures ? 1 : 0;
+}